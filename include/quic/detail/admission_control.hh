@@ -0,0 +1,99 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_ADMISSION_CONTROL_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_ADMISSION_CONTROL_HH__
+
+#include <seastar/net/socket_defs.hh>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief Keeps handshake floods away from the engine of a single shard.
+ *
+ * Every Initial packet that lsquic sees costs a round of TLS work, and
+ * spoofed ones never complete. The shard counts the handshakes in flight
+ * and, once there are `threshold` of them, only lets Initials in from source
+ * addresses that have completed a handshake recently. Other clients are
+ * deferred: their Initials are dropped and they try again once their probe
+ * timer fires, by which time the flood may have passed. Established
+ * connections are never affected.
+ */
+class admission_control {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct stats {
+        /** Initials dropped because the shard was busy and the address unknown. */
+        std::uint64_t deferred  = 0;
+        /** Initials let in while busy because the address had been validated. */
+        std::uint64_t validated = 0;
+    };
+
+private:
+    /** Bounds the memory of both caches under a flood of distinct addresses. */
+    static constexpr std::size_t MAX_ENTRIES = 1 << 16;
+
+    std::size_t                                 m_threshold         = 0;
+    clock::duration                             m_handshake_timeout = std::chrono::seconds(10);
+    clock::duration                             m_validated_ttl     = std::chrono::minutes(10);
+
+    /**
+     * Handshakes in flight and when they are given up on, by the address and
+     * port of the client. The destination connection ID changes once the
+     * server has answered, the client's address doesn't.
+     */
+    std::unordered_map<std::string, clock::time_point> m_pending{};
+    std::deque<std::pair<clock::time_point, std::string>> m_pending_order{};
+
+    /** Source addresses, without the port, that have completed a handshake. */
+    std::unordered_map<std::string, clock::time_point> m_validated{};
+    std::deque<std::pair<clock::time_point, std::string>> m_validated_order{};
+
+    stats                                       m_stats{};
+
+public:
+    /** @param threshold Handshakes in flight above which unknown clients are deferred; 0 never defers. */
+    void configure(const std::size_t threshold, const clock::duration handshake_timeout,
+            const clock::duration validated_ttl) noexcept {
+        m_threshold         = threshold;
+        m_handshake_timeout = handshake_timeout;
+        m_validated_ttl     = validated_ttl;
+    }
+
+    /**
+     * @brief Decides whether a datagram may be fed to the engine.
+     * @return false if it is an Initial packet to be dropped.
+     */
+    bool admit(const unsigned char *data, const std::size_t size, const seastar::socket_address &src);
+
+    /** @brief Marks the handshake with `peer` as finished, and `peer` as validated if it has succeeded. */
+    void handshake_finished(const seastar::socket_address &peer, const bool succeeded);
+
+    std::size_t pending_handshakes() const noexcept {
+        return m_pending.size();
+    }
+
+    bool busy() const noexcept {
+        return m_threshold && m_pending.size() >= m_threshold;
+    }
+
+    const stats &get_stats() const noexcept {
+        return m_stats;
+    }
+
+private:
+    void expire(const clock::time_point now);
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_ADMISSION_CONTROL_HH__
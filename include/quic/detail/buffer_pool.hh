@@ -0,0 +1,208 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_BUFFER_POOL_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_BUFFER_POOL_HH__
+
+#include <seastar/core/deleter.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>      // std::launder
+#include <optional>
+#include <utility>  // std::exchange
+#include <vector>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief Shard-local pool of fixed-size packet buffers.
+ *
+ * Slabs are carved out of chunks allocated in bulk and are never given back
+ * to the allocator; a released slab goes onto a free list and is reused by
+ * the next request. Once the pool has grown to the high-water mark of the
+ * traffic, handing out and returning buffers does not allocate.
+ */
+class buffer_pool {
+public:
+    struct statistics {
+        /** Requests served from the free list. */
+        std::uint64_t hits              = 0;
+        /** Requests that forced the pool to grow. */
+        std::uint64_t misses            = 0;
+        std::size_t   in_use            = 0;
+        std::size_t   high_water_mark   = 0;
+        std::size_t   capacity          = 0;
+    };
+
+private:
+    struct slab;
+
+    /**
+     * Releases a slab once seastar is done with it. It lives in the header of
+     * the slab, so `delete` only runs the destructor and frees nothing.
+     */
+    struct slab_deleter final : seastar::deleter::impl {
+        slab *owner;
+
+        explicit slab_deleter(slab *s) noexcept
+        : impl(seastar::deleter())
+        , owner(s) {}
+
+        ~slab_deleter() override;
+
+        static void operator delete(void*) noexcept {}
+    };
+
+    struct slab {
+        buffer_pool *pool       = nullptr;
+        slab        *next_free  = nullptr;
+        unsigned     refs       = 0;
+        /** Whether `deleter_storage` holds a live `slab_deleter`, which owns one reference. */
+        bool         has_deleter = false;
+        alignas(slab_deleter) unsigned char deleter_storage[sizeof(slab_deleter)];
+
+        slab_deleter *deleter() noexcept {
+            return std::launder(reinterpret_cast<slab_deleter*>(deleter_storage));
+        }
+    };
+
+    static constexpr std::size_t HEADER_SIZE =
+        (sizeof(slab) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+    static constexpr std::size_t SLABS_PER_CHUNK = 64;
+
+public:
+    /** @brief A reference to a slab. Copies are made explicitly with `share`. */
+    class buffer {
+    private:
+        slab        *m_slab = nullptr;
+        std::size_t  m_size = 0;
+
+    private:
+        friend class buffer_pool;
+
+        buffer(slab *s, const std::size_t size) noexcept
+        : m_slab(s)
+        , m_size(size) {}
+
+    public:
+        buffer() noexcept = default;
+        buffer(const buffer&) = delete;
+        buffer &operator=(const buffer&) = delete;
+
+        buffer(buffer &&other) noexcept
+        : m_slab(std::exchange(other.m_slab, nullptr))
+        , m_size(std::exchange(other.m_size, 0)) {}
+
+        buffer &operator=(buffer &&other) noexcept {
+            if (this != std::addressof(other)) {
+                reset();
+                m_slab = std::exchange(other.m_slab, nullptr);
+                m_size = std::exchange(other.m_size, 0);
+            }
+            return *this;
+        }
+
+        ~buffer() {
+            reset();
+        }
+
+        explicit operator bool() const noexcept {
+            return m_slab != nullptr;
+        }
+
+        char *get_write() noexcept {
+            return reinterpret_cast<char*>(m_slab) + HEADER_SIZE;
+        }
+
+        const char *get() const noexcept {
+            return reinterpret_cast<const char*>(m_slab) + HEADER_SIZE;
+        }
+
+        std::size_t size() const noexcept {
+            return m_size;
+        }
+
+        /** @brief Returns another reference to the first `size` bytes of the slab. */
+        buffer share(const std::size_t size) const noexcept {
+            ++m_slab->refs;
+            return buffer{m_slab, size};
+        }
+
+        /** @brief Gives up the reference without returning the slab to the pool. */
+        char *release() noexcept {
+            char *result = get_write();
+            m_slab = nullptr;
+            m_size = 0;
+            return result;
+        }
+
+        /** @brief Turns the reference into a buffer that seastar can own, without allocating. */
+        seastar::temporary_buffer<char> to_temporary_buffer() &&;
+
+        void reset() noexcept {
+            if (m_slab) {
+                m_slab->pool->put(std::exchange(m_slab, nullptr));
+                m_size = 0;
+            }
+        }
+    };
+
+private:
+    std::size_t                          m_slab_size;
+    std::size_t                          m_stride;
+    /** Sorted by address, so `owns` can binary search them. */
+    std::vector<std::unique_ptr<char[]>> m_chunks{};
+    slab                                *m_free     = nullptr;
+    statistics                           m_stats{};
+
+public:
+    explicit buffer_pool(const std::size_t slab_size);
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool &operator=(const buffer_pool&) = delete;
+
+    std::size_t slab_size() const noexcept {
+        return m_slab_size;
+    }
+
+    const statistics &stats() const noexcept {
+        return m_stats;
+    }
+
+    /** @brief Returns a buffer of `size` bytes, or nothing if `size` exceeds the slab size. */
+    std::optional<buffer> get(const std::size_t size);
+
+    /** @brief Checks whether `ptr` is the beginning of a slab's payload. */
+    bool owns(const void *ptr) const noexcept;
+
+    /**
+     * @brief Adopts a reference previously given up with `buffer::release`.
+     * @pre   `owns(ptr)`
+     */
+    buffer adopt(void *ptr, const std::size_t size) noexcept;
+
+    /**
+     * @brief Takes another reference to the slab starting at `ptr`.
+     * @pre   `owns(ptr)`
+     */
+    buffer share(void *ptr, const std::size_t size) noexcept {
+        buffer result = adopt(ptr, size);
+        ++result.m_slab->refs;
+        return result;
+    }
+
+private:
+    void grow();
+    void put(slab *s) noexcept;
+};
+
+/** @brief The pool of the current shard, with slabs of `DATAGRAM_SIZE` bytes. */
+buffer_pool &local_buffer_pool();
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_BUFFER_POOL_HH__
@@ -13,8 +13,10 @@ lsquic_stream_ctx_t *on_new_stream(void *stream_if_ctx, lsquic_stream *stream);
 void                 on_read(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx);
 void                 on_write(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx);
 void                 on_close(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx);
-// void                 on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status handshake_status);
+void                 on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status handshake_status);
 int                  packets_out(void *packets_out_ctx, const lsquic_out_spec *specs, unsigned int count);
+void                *packet_allocate(void *pmi_ctx, void *peer_ctx, lsquic_conn_ctx_t *conn_ctx, unsigned short size, char is_ipv6);
+void                 packet_release(void *pmi_ctx, void *peer_ctx, void *buffer, char is_ipv6);
 
 
 } // namespace detail
@@ -0,0 +1,177 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_CONNECTION_REGISTRY_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_CONNECTION_REGISTRY_HH__
+
+#include <lsquic/lsquic.h>
+
+#include <boost/intrusive/list.hpp>
+
+#include <quic/common.hh>
+#include <quic/quic_stream.hh>
+#include <quic/detail/object_pool.hh>
+#include <quic/detail/transport_stats.hh>
+#include <quic/ssl/ssl_handler.hh>
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+class connection_registry;
+struct connection_context;
+
+/** @brief State of a single stream, passed to lsquic as its `lsquic_stream_ctx_t`. */
+struct stream_context : public base_quic_stream<quic_stream_value_t> {
+    connection_registry *registry;
+    connection_context  *connection;
+    lsquic_stream_t     *stream;
+    std::size_t          bytes_sent = 0;
+    /** Set when on_read stops reading because the application is behind. */
+    bool                 reading_paused = false;
+    /** Links the context into its registry until it's disposed of. */
+    boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> live_hook{};
+
+    stream_context(connection_registry *reg, connection_context *conn, lsquic_stream_t *s) noexcept;
+};
+
+/** @brief State of a single connection, passed to lsquic as its `lsquic_conn_ctx_t`. */
+struct connection_context {
+    connection_registry                                    *registry;
+    lsquic_conn_t                                          *connection;
+    std::unordered_map<lsquic_stream_id_t, stream_context*> streams{};
+    connection_stats                                        stats{};
+    /** Set once `on_hsk_done` has reported the outcome of the handshake. */
+    bool                                                    handshake_finished = false;
+    boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> live_hook{};
+
+    connection_context(connection_registry *reg, lsquic_conn_t *conn) noexcept
+    : registry(reg)
+    , connection(conn) {}
+};
+
+/**
+ * @brief Owner of the connection and stream contexts of a single engine.
+ *
+ * Contexts are slab-allocated. A connection context lives from `on_new_conn`
+ * to `on_conn_closed`. A stream context is also referenced by every
+ * `quic_stream` handed to the application, so it is only returned to the pool
+ * once lsquic has closed the stream and the application has dropped it.
+ */
+class connection_registry {
+private:
+    using live_streams_t = boost::intrusive::list<stream_context,
+        boost::intrusive::member_hook<stream_context, decltype(stream_context::live_hook), &stream_context::live_hook>,
+        boost::intrusive::constant_time_size<false>>;
+    using live_connections_t = boost::intrusive::list<connection_context,
+        boost::intrusive::member_hook<connection_context, decltype(connection_context::live_hook), &connection_context::live_hook>,
+        boost::intrusive::constant_time_size<false>>;
+
+private:
+    object_pool<connection_context> m_connections{};
+    object_pool<stream_context>     m_streams{};
+    /** Every stream context not yet disposed of, including those only the application holds. */
+    live_streams_t                  m_live_streams{};
+    live_connections_t              m_live_connections{};
+    std::size_t                     m_open_streams = 0;
+    std::size_t                     m_max_stream_buffer =
+        one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_MAX_CAPACITY;
+    std::size_t                     m_low_watermark =
+        one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_LOW_WATERMARK;
+    std::size_t                     m_high_watermark =
+        one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_HIGH_WATERMARK;
+    /** Asks the owner of the engine to tick it soon. */
+    std::function<void()>           m_wakeup{};
+    /** Called with every connection about to be closed. */
+    std::function<void(connection_context&)> m_on_close{};
+    ssl::handshake_stats            m_handshakes{};
+    /** Called once per connection, when its handshake succeeds or fails. */
+    std::function<void(connection_context&, bool)> m_on_handshake{};
+
+private:
+    friend struct stream_context;
+
+public:
+    connection_registry() = default;
+    connection_registry(connection_registry&&) = default;
+    connection_registry &operator=(connection_registry&&) = default;
+
+    /** @brief Applies to the streams opened from now on. */
+    void set_max_stream_buffer(const std::size_t size) noexcept {
+        m_max_stream_buffer = size;
+    }
+
+    /** @brief Applies to the streams opened from now on. */
+    void set_stream_watermarks(const std::size_t low, const std::size_t high) noexcept {
+        m_low_watermark  = low;
+        m_high_watermark = high;
+    }
+
+    /** @brief `wakeup` is called when the application gives lsquic something to do outside of a tick. */
+    void set_wakeup(std::function<void()> wakeup) {
+        m_wakeup = std::move(wakeup);
+    }
+
+    /** @brief `on_close` is called from `close_connection`, while lsquic still knows the connection. */
+    void set_close_observer(std::function<void(connection_context&)> on_close) {
+        m_on_close = std::move(on_close);
+    }
+
+    /**
+     * @brief `on_handshake` is told whether the handshake of a connection has
+     *        succeeded, or that it has failed if the connection closes first.
+     */
+    void set_handshake_observer(std::function<void(connection_context&, bool)> on_handshake) {
+        m_on_handshake = std::move(on_handshake);
+    }
+
+    /** @brief Records the outcome reported by `on_hsk_done`. */
+    void handshake_finished(connection_context *ctx, lsquic_hsk_status status) noexcept;
+
+    template<typename Func>
+    void for_each_connection(Func &&func) {
+        for (connection_context &ctx : m_live_connections) {
+            func(ctx);
+        }
+    }
+
+    connection_context *open_connection(lsquic_conn_t *connection);
+    /** @pre All the streams of `ctx` have been closed. */
+    void                close_connection(connection_context *ctx) noexcept;
+
+    stream_context     *open_stream(connection_context *ctx, lsquic_stream_t *stream);
+    /** @brief Detaches `ctx` from lsquic and drops lsquic's reference to it. */
+    void                close_stream(stream_context *ctx) noexcept;
+
+    std::size_t connection_count() const noexcept {
+        return m_connections.size();
+    }
+
+    /** @brief Number of streams not yet closed by lsquic. */
+    std::size_t stream_count() const noexcept {
+        return m_open_streams;
+    }
+
+    ssl::handshake_stats &handshakes() noexcept {
+        return m_handshakes;
+    }
+
+    const ssl::handshake_stats &handshakes() const noexcept {
+        return m_handshakes;
+    }
+
+    /** @brief Bytes buffered by the streams of this registry. Walks every stream, so keep it off hot paths. */
+    std::size_t buffered_bytes() const noexcept;
+
+private:
+    static void dispose(base_quic_stream<quic_stream_value_t> *stream) noexcept;
+    static void stream_written(base_quic_stream<quic_stream_value_t> *stream) noexcept;
+    static void stream_consumed(base_quic_stream<quic_stream_value_t> *stream) noexcept;
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_CONNECTION_REGISTRY_HH__
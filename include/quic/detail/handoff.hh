@@ -0,0 +1,124 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_HANDOFF_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_HANDOFF_HH__
+
+#include <quic/detail/udp_socket.hh>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/internal/pollable_fd.hh>
+#include <seastar/net/socket_defs.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/un.h>  // sockaddr_un
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/*
+ * A restart hands the UDP sockets of a running process over to its
+ * successor through a Unix socket, so no datagram is left on a socket nobody
+ * reads and the kernel keeps spreading flows over the same sockets. The
+ * successor reads every datagram from then on, and relays the ones
+ * belonging to connections of the previous process there until it has
+ * drained. The two are told apart by the generation bit of the connection
+ * IDs, see `set_cid_generation`.
+ */
+
+/** @brief A handoff that can't be carried out. */
+class handoff_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/** @brief What a process taking over gets from its predecessor. */
+struct takeover {
+    /** The generation of the predecessor's connection IDs. */
+    std::uint8_t        generation;
+    /** A bound UDP socket for every shard of the predecessor, owned by the caller. */
+    std::vector<int>    sockets;
+};
+
+/**
+ * @brief Connects to the process listening on `path` and takes its sockets
+ *        over. Blocks, so it is meant to be called before serving anything.
+ * @param shards The sockets expected; the predecessor keeps its own if it
+ *        has another number of them.
+ * @throws handoff_error if the predecessor can't be reached or misbehaves.
+ */
+takeover take_over(const std::string &path, const std::size_t shards);
+
+/** @brief A process that has connected to take the sockets over. */
+class successor {
+private:
+    seastar::pollable_fd m_fd;
+
+public:
+    explicit successor(seastar::pollable_fd fd) noexcept
+    : m_fd(std::move(fd)) {}
+
+    /**
+     * @brief Sends the generation of this process and its `sockets`, one per
+     *        shard. Resolves once the successor has confirmed it has them, so
+     *        they are read by someone at any time.
+     */
+    seastar::future<> hand_over(const std::uint8_t generation, const std::vector<int> &sockets);
+};
+
+/** @brief Listens on `path`, replacing whatever is there, until a successor connects. */
+seastar::future<successor> wait_for_successor(const std::string &path);
+
+/** @brief The address the relay of `shard` of the process of `generation` is bound to. */
+sockaddr_un relay_address(const std::string &path, const std::uint8_t generation, const unsigned shard);
+
+/** @brief What has happened to a relayed datagram. */
+enum class relay_result {
+    sent,
+    /** The receiving relay is full. */
+    dropped,
+    /** Nobody listens on the address any more. */
+    gone
+};
+
+/**
+ * @brief A Unix datagram socket carrying UDP datagrams, together with their
+ *        source address and ECN bits, from one process to another.
+ */
+class datagram_relay {
+private:
+    seastar::pollable_fd                m_fd;
+    std::unique_ptr<unsigned char[]>    m_buffer{};
+
+public:
+    /** @brief A relay datagrams are only sent from. */
+    datagram_relay();
+    /** @brief A relay receiving the datagrams sent to `address`. */
+    explicit datagram_relay(const sockaddr_un &address);
+
+    relay_result send(const sockaddr_un &to, const unsigned char *data, const std::size_t size,
+            const seastar::socket_address &src, const int ecn) noexcept;
+
+    /** @brief Resolves once there is a datagram to receive. */
+    seastar::future<> readable() {
+        return m_fd.readable();
+    }
+
+    /** @brief Passes up to `max` datagrams already queued on the relay to `handler`. */
+    std::size_t receive(const std::size_t max, udp_socket::receive_handler &handler);
+
+    /** @brief Fails a pending `readable` and every later one. */
+    void shutdown_input() {
+        m_fd.abort_reader();
+    }
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_HANDOFF_HH__
@@ -0,0 +1,66 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_HISTOGRAM_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_HISTOGRAM_HH__
+
+#include <seastar/core/metrics_types.hh>
+
+#include <array>
+#include <bit>      // std::bit_width
+#include <cstddef>
+#include <cstdint>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief A histogram with power-of-two buckets: bucket `i` counts samples
+ *        in the range (2^(i-1), 2^i]. Samples above the last bound only
+ *        count towards the total.
+ */
+template<std::size_t BucketCount>
+class log2_histogram {
+private:
+    std::array<std::uint64_t, BucketCount> m_buckets{};
+    std::uint64_t                          m_count  = 0;
+    std::uint64_t                          m_sum    = 0;
+
+public:
+    void add(const std::uint64_t value) noexcept {
+        ++m_count;
+        m_sum += value;
+
+        const std::size_t idx = value <= 1 ? 0 : std::bit_width(value - 1);
+        if (idx < BucketCount) {
+            ++m_buckets[idx];
+        }
+    }
+
+    std::uint64_t count() const noexcept {
+        return m_count;
+    }
+
+    std::uint64_t sum() const noexcept {
+        return m_sum;
+    }
+
+    seastar::metrics::histogram to_metrics() const {
+        seastar::metrics::histogram result{};
+        result.sample_count = m_count;
+        result.sample_sum   = static_cast<double>(m_sum);
+        result.buckets.resize(BucketCount);
+
+        std::uint64_t cumulative = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i) {
+            cumulative += m_buckets[i];
+            result.buckets[i].count       = cumulative;
+            result.buckets[i].upper_bound = static_cast<double>(std::uint64_t{1} << i);
+        }
+        return result;
+    }
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_HISTOGRAM_HH__
@@ -0,0 +1,95 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_OBJECT_POOL_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_OBJECT_POOL_HH__
+
+#include <cstddef>
+#include <memory>
+#include <new>      // placement new
+#include <utility>  // std::forward
+#include <vector>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief Slab allocator for objects of a single type.
+ *
+ * Storage is allocated `ObjectsPerChunk` objects at a time and recycled
+ * through a free list, so creating and destroying objects at a steady rate
+ * does not reach the allocator. The pool must outlive every object it has
+ * created.
+ */
+template<typename T, std::size_t ObjectsPerChunk = 64>
+class object_pool {
+private:
+    union slot {
+        slot *next_free;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+private:
+    std::vector<std::unique_ptr<slot[]>>    m_chunks{};
+    slot                                   *m_free      = nullptr;
+    std::size_t                             m_in_use    = 0;
+
+public:
+    object_pool() = default;
+    object_pool(const object_pool&) = delete;
+    object_pool &operator=(const object_pool&) = delete;
+
+    object_pool(object_pool &&other) noexcept
+    : m_chunks(std::move(other.m_chunks))
+    , m_free(std::exchange(other.m_free, nullptr))
+    , m_in_use(std::exchange(other.m_in_use, 0)) {}
+
+    /** @pre No object created by `*this` is alive. */
+    object_pool &operator=(object_pool &&other) noexcept {
+        m_chunks = std::move(other.m_chunks);
+        m_free   = std::exchange(other.m_free, nullptr);
+        m_in_use = std::exchange(other.m_in_use, 0);
+        return *this;
+    }
+
+    template<typename... Args>
+    T *create(Args &&...args) {
+        if (!m_free) {
+            grow();
+        }
+
+        slot *s    = m_free;
+        slot *next = s->next_free;
+        T *result = new (s->storage) T(std::forward<Args>(args)...);
+        m_free = next;
+        ++m_in_use;
+        return result;
+    }
+
+    void destroy(T *object) noexcept {
+        object->~T();
+        slot *s = reinterpret_cast<slot*>(object);
+        s->next_free = std::exchange(m_free, s);
+        --m_in_use;
+    }
+
+    std::size_t size() const noexcept {
+        return m_in_use;
+    }
+
+    std::size_t capacity() const noexcept {
+        return m_chunks.size() * ObjectsPerChunk;
+    }
+
+private:
+    void grow() {
+        auto &chunk = m_chunks.emplace_back(new slot[ObjectsPerChunk]);
+        for (std::size_t i = ObjectsPerChunk; i-- > 0;) {
+            chunk[i].next_free = std::exchange(m_free, &chunk[i]);
+        }
+    }
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_OBJECT_POOL_HH__
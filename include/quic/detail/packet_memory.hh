@@ -0,0 +1,55 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_PACKET_MEMORY_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_PACKET_MEMORY_HH__
+
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/net/packet.hh>
+
+#include <quic/detail/buffer_pool.hh>
+
+#include <sys/uio.h>    // iovec
+
+#include <cstddef>
+#include <unordered_map>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief Owner of the buffers lsquic writes outgoing packets into.
+ *
+ * lsquic allocates its packet buffers through `lsquic_packout_mem_if`
+ * and releases them as soon as `packets_out` returns, while the UDP send
+ * completes later. Every buffer handed out here is a reference-counted slab
+ * of the shard's `buffer_pool`, so a send can share it instead of copying
+ * and the slab goes back to the pool once both lsquic and the send are done
+ * with it. Only packets larger than a slab fall back to the allocator.
+ */
+class packet_memory {
+private:
+    buffer_pool                                                     *m_pool;
+    std::unordered_map<const void*, seastar::temporary_buffer<char>> m_oversized{};
+
+public:
+    packet_memory()
+    : m_pool(std::addressof(local_buffer_pool())) {}
+
+    packet_memory(packet_memory&&) = default;
+    packet_memory &operator=(packet_memory&&) = default;
+
+    void *allocate(const std::size_t size);
+    /** @brief Drops lsquic's reference to `buffer`. */
+    void  release(void *buffer);
+
+    /**
+     * @brief Builds a packet out of `iov`. Fragments pointing into buffers
+     *        allocated by `allocate` are shared, the others are copied.
+     */
+    seastar::net::packet gather(const iovec *iov, const std::size_t iovlen);
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_PACKET_MEMORY_HH__
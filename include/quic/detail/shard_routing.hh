@@ -0,0 +1,58 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_SHARD_ROUTING_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_SHARD_ROUTING_HH__
+
+#include <lsquic/lsquic.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/**
+ * @brief Returns the shard that owns the connection a packet with the
+ *        destination connection ID `dcid` belongs to.
+ *
+ * Connection IDs generated by `generate_scid` carry the id of the shard that
+ * created them in their first byte. Client-chosen IDs (Initial and 0-RTT
+ * packets) map onto a pseudo-random but stable shard, which then becomes the
+ * owner by handing out its own IDs in the handshake.
+ */
+unsigned owner_shard(const lsquic_cid_t &dcid) noexcept;
+
+/**
+ * @brief Finds the shard a datagram has to be processed on.
+ * @return The owning shard, or the current one if the datagram carries no
+ *         parsable connection ID.
+ */
+unsigned route_datagram(const unsigned char *data, const std::size_t size) noexcept;
+
+/**
+ * @brief Sets the generation, 0 or 1, of the IDs generated from now on.
+ *
+ * The top bit of the second byte of every ID tells which of two processes
+ * sharing the port across a restart has issued it. Call it before the shards
+ * start serving.
+ */
+void set_cid_generation(const std::uint8_t generation) noexcept;
+std::uint8_t cid_generation() noexcept;
+
+/**
+ * @brief Tells whether a datagram belongs to a connection whose IDs have been
+ *        issued by the other generation.
+ *
+ * Only short-header and Handshake packets of IETF QUIC are considered: Initial
+ * and 0-RTT packets may carry IDs chosen by the client, and those are never
+ * some other process' business.
+ */
+bool issued_by_other_generation(const unsigned char *data, const std::size_t size) noexcept;
+
+/** @brief lsquic's `ea_generate_scid` hook, tagging every ID with the current shard and generation. */
+void generate_scid(void *ctx, lsquic_conn_t *connection, lsquic_cid_t *scid, unsigned len);
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_SHARD_ROUTING_HH__
@@ -0,0 +1,118 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_TRANSPORT_STATS_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_TRANSPORT_STATS_HH__
+
+#include <lsquic/lsquic.h>
+
+#include <quic/detail/histogram.hh>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/** @brief Transport state of a single connection, as last reported by `lsquic_conn_get_info`. */
+struct connection_stats {
+    std::chrono::steady_clock::time_point   opened_at   = std::chrono::steady_clock::now();
+    lsquic_conn_info                        info{};
+    /** Set once `info` has been filled in. */
+    bool                                    sampled     = false;
+
+    /** @return false if lsquic has no information about the connection. */
+    bool update(lsquic_conn_t *connection) noexcept;
+};
+
+/**
+ * @brief Aggregates the transport state of the connections of a single engine.
+ *
+ * Live connections are sampled periodically by their server; closed ones are
+ * recorded once more and, optionally, written out as JSON lines. The lines
+ * are buffered and written by a thread of their own, so the shard never
+ * waits for the disk.
+ */
+class transport_stats {
+public:
+    /** Microseconds, up to about 8 seconds. */
+    using rtt_histogram_t       = log2_histogram<24>;
+    /** Bytes, up to 1 GiB. */
+    using cwnd_histogram_t      = log2_histogram<31>;
+    /** Packets per connection, up to about a million. */
+    using packets_histogram_t   = log2_histogram<21>;
+
+private:
+    rtt_histogram_t             m_rtt{};
+    cwnd_histogram_t            m_cwnd{};
+    packets_histogram_t         m_lost_per_connection{};
+    packets_histogram_t         m_retx_per_connection{};
+    std::uint64_t               m_samples       = 0;
+    std::uint64_t               m_closed        = 0;
+    std::uint64_t               m_packets_lost  = 0;
+    std::uint64_t               m_packets_retx  = 0;
+
+    class dump_writer;
+    std::unique_ptr<dump_writer> m_dump{};
+    /** Lines written since the last `flush`. */
+    std::ostringstream          m_lines{};
+
+public:
+    transport_stats();
+    transport_stats(transport_stats&&) noexcept;
+    transport_stats &operator=(transport_stats&&) noexcept;
+    ~transport_stats();
+
+    /** @brief Appends a JSON line per closed connection to `path`. */
+    void dump_to(const std::string &path);
+
+    /** @brief Samples a live connection. */
+    void sample(lsquic_conn_t *connection, connection_stats &stats) noexcept;
+    /** @brief Records a connection from its `on_conn_closed`. */
+    void closed(lsquic_conn_t *connection, connection_stats &stats);
+    /** @brief Hands the buffered JSON lines over to the writing thread. */
+    void flush();
+
+    const rtt_histogram_t &rtt() const noexcept {
+        return m_rtt;
+    }
+
+    const cwnd_histogram_t &cwnd() const noexcept {
+        return m_cwnd;
+    }
+
+    const packets_histogram_t &lost_per_connection() const noexcept {
+        return m_lost_per_connection;
+    }
+
+    const packets_histogram_t &retransmitted_per_connection() const noexcept {
+        return m_retx_per_connection;
+    }
+
+    std::uint64_t samples() const noexcept {
+        return m_samples;
+    }
+
+    std::uint64_t closed_connections() const noexcept {
+        return m_closed;
+    }
+
+    std::uint64_t packets_lost() const noexcept {
+        return m_packets_lost;
+    }
+
+    std::uint64_t packets_retransmitted() const noexcept {
+        return m_packets_retx;
+    }
+
+private:
+    void add_sample(const lsquic_conn_info &info) noexcept;
+    void write_json(lsquic_conn_t *connection, const connection_stats &stats);
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_TRANSPORT_STATS_HH__
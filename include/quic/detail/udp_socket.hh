@@ -0,0 +1,153 @@
+#ifndef __QUIC_FILEHOST_QUIC_DETAIL_UDP_SOCKET_HH__
+#define __QUIC_FILEHOST_QUIC_DETAIL_UDP_SOCKET_HH__
+
+#include <seastar/core/circular_buffer.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/internal/pollable_fd.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/net/packet.hh>
+#include <seastar/net/socket_defs.hh>
+#include <seastar/util/noncopyable_function.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <sys/socket.h>  // mmsghdr
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/** @brief Converts an IPv4 or IPv6 address given by the kernel or lsquic. */
+seastar::socket_address to_socket_address(const sockaddr *sa);
+
+/** @brief A datagram waiting for its turn on the socket. */
+struct outgoing_datagram {
+    seastar::socket_address     destination;
+    seastar::net::packet        packet;
+};
+
+/**
+ * @brief A UDP socket driven with plain syscalls.
+ *
+ * Unlike `seastar::net::udp_channel`, which makes a syscall per datagram,
+ * the socket hands whole queues of datagrams to the kernel with `sendmmsg`.
+ * Consecutive datagrams of equal size going to the same peer are merged into
+ * a single UDP GSO send when the kernel supports it. Received datagrams are
+ * pulled in batches with `recvmmsg`, coalesced by UDP GRO where available.
+ * The socket is bound with `SO_REUSEPORT`, so every shard can have its own
+ * one on the same port.
+ */
+class udp_socket {
+public:
+    using receive_handler = seastar::noncopyable_function<
+            void(const unsigned char *data, std::size_t size, const seastar::socket_address &src, int ecn)>;
+
+    struct statistics {
+        /** `sendmmsg` calls that have sent something. */
+        std::uint64_t send_calls        = 0;
+        std::uint64_t datagrams_sent    = 0;
+        /** Messages carrying more than one datagram. */
+        std::uint64_t gso_messages      = 0;
+        std::uint64_t send_errors       = 0;
+        /** `recvmmsg` calls that have received something. */
+        std::uint64_t receive_calls     = 0;
+        std::uint64_t datagrams_received = 0;
+        /** Received messages that GRO has made out of more than one datagram. */
+        std::uint64_t gro_messages      = 0;
+    };
+
+    /** Messages handed to the kernel by a single `sendmmsg` call. */
+    static constexpr std::size_t MAX_MESSAGES       = 64;
+    /** Datagrams merged into a single GSO message. */
+    static constexpr std::size_t MAX_GSO_SEGMENTS   = 64;
+    /** Payload of a GSO message; has to fit a single IP packet. */
+    static constexpr std::size_t MAX_GSO_BYTES      = 0xffff - 8 - 40;
+
+private:
+    struct scratch;
+
+private:
+    seastar::pollable_fd        m_fd;
+    seastar::socket_address     m_local;
+    bool                        m_gso;
+    bool                        m_gro;
+    /** Set if the kernel reports the ECN bits of received datagrams. */
+    bool                        m_ecn;
+    std::unique_ptr<scratch>    m_scratch;
+    statistics                  m_stats{};
+
+public:
+    /** @brief Binds a socket to `port` on every IPv4 address. `gso` and `gro` are ignored if the kernel lacks them. */
+    udp_socket(const std::uint16_t port, const bool gso, const bool gro);
+    /** @brief Takes over `fd`, a bound UDP socket, e.g. one handed over by another process. */
+    udp_socket(seastar::file_desc fd, const bool gso, const bool gro);
+    udp_socket(udp_socket&&) noexcept;
+    udp_socket &operator=(udp_socket&&) noexcept;
+    ~udp_socket();
+
+    const seastar::socket_address &local_address() const noexcept {
+        return m_local;
+    }
+
+    int native_handle() const noexcept {
+        return m_fd.get_file_desc().get();
+    }
+
+    bool gso() const noexcept {
+        return m_gso;
+    }
+
+    bool gro() const noexcept {
+        return m_gro;
+    }
+
+    bool ecn() const noexcept {
+        return m_ecn;
+    }
+
+    const statistics &stats() const noexcept {
+        return m_stats;
+    }
+
+    /**
+     * @brief Sends the datagrams of `queue` from its front, popping them as
+     *        they are handed over to the kernel. Datagrams pushed to `queue`
+     *        in the meantime are sent too.
+     * @note  The queue has to outlive the returned future.
+     */
+    seastar::future<> send(seastar::circular_buffer<outgoing_datagram> &queue);
+
+    /** @brief Resolves once there is a datagram to receive. */
+    seastar::future<> readable() {
+        return m_fd.readable();
+    }
+
+    /** @brief Fails a pending `readable` and every later one. */
+    void shutdown_input() {
+        m_fd.abort_reader();
+    }
+
+    /**
+     * @brief Passes the datagrams already queued on the socket to `handler`,
+     *        together with their ECN bits, receiving up to `max` of them with
+     *        as few `recvmmsg` calls as possible.
+     * @return How many datagrams have been received; a GRO message may push
+     *         it somewhat past `max`.
+     */
+    std::size_t receive(const std::size_t max, receive_handler &handler);
+
+private:
+    /** @return How many datagrams `message` carried. */
+    std::size_t deliver(mmsghdr &message, receive_handler &handler);
+
+    /** @return How many datagrams have left `queue`, 0 if the socket is full. */
+    std::size_t send_some(seastar::circular_buffer<outgoing_datagram> &queue);
+};
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_DETAIL_UDP_SOCKET_HH__
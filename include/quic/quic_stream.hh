@@ -1,78 +1,340 @@
 #ifndef __QUIC_FILEHOST_QUIC_QUIC_STREAM_HH__
 #define __QUIC_FILEHOST_QUIC_QUIC_STREAM_HH__
 
+#include <seastar/core/future.hh>
+#include <seastar/core/loop.hh>     // seastar::repeat
+#include <seastar/core/temporary_buffer.hh>
+
 #include <memory>
 #include <quic/common.hh>
 
 #include <quic/detail/callbacks.hh>
 
+#include <algorithm>    // std::min, std::max
+#include <array>
+#include <bit>          // std::bit_ceil
 #include <cstddef>
-#include <cstring>  // std::memcpy
+#include <cstring>      // std::memcpy
+#include <deque>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>    // std::runtime_error
+#include <utility>      // std::exchange, std::swap
 #include <vector>
 
 namespace zpp {
 namespace quic {
+
+/** @brief Reported to writers waiting on a stream that lsquic has closed. */
+class stream_closed_error : public std::runtime_error {
+public:
+    stream_closed_error()
+    : std::runtime_error("The QUIC stream has been closed.") {}
+};
+
 namespace detail {
 
+/**
+ * @brief A byte queue backed by a ring buffer.
+ *
+ * The buffer grows by doubling until it reaches `max_capacity()` and consumed
+ * bytes are reclaimed as soon as they are dropped, so the memory held by a
+ * stream is bounded by the amount of data in flight rather than by the total
+ * amount of data ever written. Wrapping around never moves data; the readable
+ * and writable regions are exposed as (at most) two contiguous spans each.
+ *
+ * Whole `seastar::temporary_buffer`s can also be queued with `append`, which
+ * takes ownership of them instead of copying. They are read after the data in
+ * the ring; bytes written while any of them is queued are queued as a chunk
+ * as well, so the order of writes is kept.
+ */
 template<typename ByteType>
     requires (sizeof(ByteType) == 1)
 class one_directionial_quic_stream {
 public:
     using value_type = ByteType;
 
+    static constexpr std::size_t MIN_CAPACITY           = 0x1000;
+    static constexpr std::size_t DEFAULT_MAX_CAPACITY   = 0x100000;
+    static constexpr std::size_t DEFAULT_HIGH_WATERMARK = 0x40000;
+    static constexpr std::size_t DEFAULT_LOW_WATERMARK  = 0x10000;
+
 private:
+    /** Its size is either 0 or a power of two. */
     std::vector<ByteType>   m_stream{};
-    std::size_t             m_begin     = 0;
-    std::size_t             m_end       = 0;
+    /** Positions in the stream, not in the buffer. They only ever grow. */
+    std::size_t             m_begin         = 0;
+    std::size_t             m_end           = 0;
+    std::size_t             m_max_capacity  = DEFAULT_MAX_CAPACITY;
+    std::size_t             m_high_watermark = DEFAULT_HIGH_WATERMARK;
+    std::size_t             m_low_watermark = DEFAULT_LOW_WATERMARK;
+    /** Resolved once the buffer drains to the low watermark. Copies of a stream may wait together. */
+    std::vector<seastar::promise<>> m_drained{};
+    /** Resolved once there is something to read or the writer has finished. */
+    std::vector<seastar::promise<>> m_readable{};
+    bool                    m_eof           = false;
+    /** Data queued after the contents of the ring. */
+    std::deque<seastar::temporary_buffer<ByteType>> m_chunks{};
+    std::size_t             m_chunk_bytes   = 0;
 
 public:
-    auto size() const noexcept {
-        return m_end - m_begin;
+    /** @brief Number of readable bytes, both in the ring and in the queued chunks. */
+    std::size_t size() const noexcept {
+        return ring_size() + m_chunk_bytes;
     }
 
-    auto capacity() const noexcept {
-        return m_stream.capacity() - m_begin;
+    std::size_t capacity() const noexcept {
+        return m_stream.size();
+    }
+
+    std::size_t max_capacity() const noexcept {
+        return m_max_capacity;
+    }
+
+    /** @brief Rounded up to a power of two. Doesn't shrink an already grown buffer. */
+    void set_max_capacity(const std::size_t max_capacity) {
+        m_max_capacity = std::bit_ceil(std::max(max_capacity, MIN_CAPACITY));
+    }
+
+    /** @brief Number of bytes that can still be written. */
+    std::size_t available() const noexcept {
+        const std::size_t limit = std::max(m_max_capacity, capacity());
+        return size() < limit ? limit - size() : 0;
     }
 
     void reserve(const std::size_t capacity) {
-        m_stream.reserve(m_begin + capacity);
+        grow(std::min(capacity, m_max_capacity));
+    }
+
+    /** @pre `low <= high` */
+    void set_watermarks(const std::size_t low, const std::size_t high) noexcept {
+        m_low_watermark  = low;
+        m_high_watermark = high;
+    }
+
+    bool above_high_watermark() const noexcept {
+        return size() >= m_high_watermark;
+    }
+
+    /** @brief Resolves once the buffer holds no more than the low watermark. Every waiter is woken up. */
+    seastar::future<> wait_drained() {
+        if (size() <= m_low_watermark) {
+            return seastar::make_ready_future<>();
+        }
+        return m_drained.emplace_back().get_future();
+    }
+
+    /** @brief Resolves once there is data to read or `eof()` holds. Every waiter is woken up. */
+    seastar::future<> wait_readable() {
+        if (size() || m_eof) {
+            return seastar::make_ready_future<>();
+        }
+        return m_readable.emplace_back().get_future();
+    }
+
+    /** @brief Marks that nothing will be written anymore. */
+    void set_eof() noexcept {
+        m_eof = true;
+        notify_readable();
+    }
+
+    bool eof() const noexcept {
+        return m_eof;
     }
 
-    void drop(const std::size_t count) {
+    /** @brief Fails the waiters of `wait_drained` and `wait_readable`, if any. */
+    void abort(std::exception_ptr ex) noexcept {
+        for (auto &drained : std::exchange(m_drained, {})) {
+            drained.set_exception(ex);
+        }
+        for (auto &readable : std::exchange(m_readable, {})) {
+            readable.set_exception(ex);
+        }
+    }
+
+    void drop(std::size_t count) {
         if (count > size()) {
             throw 1;    // TODO
         }
-        m_begin += count;
+
+        const std::size_t from_ring = std::min(count, ring_size());
+        m_begin += from_ring;
+        count   -= from_ring;
+
+        while (count) {
+            auto &chunk = m_chunks.front();
+            const std::size_t from_chunk = std::min(count, chunk.size());
+            consume_chunk_front(from_chunk);
+            count -= from_chunk;
+        }
+        notify_drained();
     }
 
-    ByteType *data() noexcept {
-        return &m_stream[m_begin];
+    /**
+     * @brief The bytes in the ring, in order. The second span is empty unless
+     *        the data wraps around. Queued chunks follow them.
+     */
+    std::array<std::span<const ByteType>, 2> readable_spans() const noexcept {
+        if (!ring_size()) {
+            return {};
+        }
+
+        const std::size_t first = offset(m_begin);
+        const std::size_t count = std::min(ring_size(), capacity() - first);
+        return {
+            std::span<const ByteType>(&m_stream[first], count),
+            std::span<const ByteType>(m_stream.data(), ring_size() - count)
+        };
     }
 
-    const ByteType *data() const noexcept {
-        return &m_stream[m_begin];
+    /**
+     * @brief The contiguous free space following the readable bytes. Confirm
+     *        writes with `commit`. Empty while chunks are queued.
+     */
+    std::span<ByteType> writable_span() noexcept {
+        const std::size_t free = capacity() - ring_size();
+        if (!free || !m_chunks.empty()) {
+            return {};
+        }
+
+        const std::size_t first = offset(m_end);
+        return std::span<ByteType>(&m_stream[first], std::min(free, capacity() - first));
     }
 
-    void write(const ByteType *buffer, const std::size_t count) {
-        if (!count) {
-            return;
+    /** @throws std::out_of_range if `count` exceeds the span last returned by `writable_span`. */
+    void commit(const std::size_t count) {
+        if (count > capacity() - ring_size() || (count && !m_chunks.empty())) {
+            throw std::out_of_range("Committing more bytes than the writable span holds.");
         }
+        m_end += count;
+        notify_readable();
+    }
 
-        if (m_end + count > m_stream.size()) {
-            m_stream.resize(std::max(2 * m_stream.size(), m_stream.size() + 2 * count));
+    /** @return The number of bytes written, less than `count` if the buffer is full. */
+    std::size_t write(const ByteType *buffer, const std::size_t count) {
+        if (!m_chunks.empty()) {
+            const std::size_t accepted = std::min(count, available());
+            if (accepted) {
+                append(seastar::temporary_buffer<ByteType>(buffer, accepted));
+            }
+            return accepted;
         }
 
-        std::memcpy(&m_stream[m_end], buffer, count);
-        m_end += count;
+        if (ring_size() + count > capacity()) {
+            grow(std::min(ring_size() + count, m_max_capacity));
+        }
+
+        std::size_t written = 0;
+        while (written < count) {
+            auto span = writable_span();
+            if (span.empty()) {
+                break;
+            }
+
+            const std::size_t chunk = std::min(span.size(), count - written);
+            std::memcpy(span.data(), buffer + written, chunk);
+            m_end += chunk;
+            written += chunk;
+        }
+
+        notify_readable();
+        return written;
+    }
+
+    /** @brief Queues `chunk` without copying it. It isn't subject to `max_capacity()`. */
+    void append(seastar::temporary_buffer<ByteType> chunk) {
+        if (chunk.empty()) {
+            return;
+        }
+        m_chunk_bytes += chunk.size();
+        m_chunks.push_back(std::move(chunk));
+        notify_readable();
     }
 
     void read(ByteType *buffer, const std::size_t count) {
-        if (count > m_end - m_begin) {
+        if (count > size()) {
             throw 1;    // TODO
         }
+        read_some(buffer, count);
+    }
 
-        std::memcpy(buffer, &m_stream[m_begin], count);
-        m_begin += count;
+    /** @return The number of bytes read, less than `count` if there are not enough of them. */
+    std::size_t read_some(ByteType *buffer, const std::size_t count) {
+        std::size_t copied = 0;
+        for (const auto &span : readable_spans()) {
+            const std::size_t chunk = std::min(span.size(), count - copied);
+            std::memcpy(buffer + copied, span.data(), chunk);
+            copied += chunk;
+        }
+        m_begin += copied;
+
+        while (copied < count && !m_chunks.empty()) {
+            const auto &front = m_chunks.front();
+            const std::size_t chunk = std::min(front.size(), count - copied);
+            std::memcpy(buffer + copied, front.get(), chunk);
+            consume_chunk_front(chunk);
+            copied += chunk;
+        }
+
+        notify_drained();
+        return copied;
+    }
+
+private:
+    std::size_t ring_size() const noexcept {
+        return m_end - m_begin;
+    }
+
+    void consume_chunk_front(const std::size_t count) noexcept {
+        auto &chunk = m_chunks.front();
+        m_chunk_bytes -= count;
+        if (count == chunk.size()) {
+            m_chunks.pop_front();
+        } else {
+            chunk.trim_front(count);
+        }
+    }
+
+    void notify_readable() noexcept {
+        if (m_readable.empty() || !(size() || m_eof)) {
+            return;
+        }
+        // A waiter that runs first and finds nothing left simply waits again.
+        for (auto &readable : std::exchange(m_readable, {})) {
+            readable.set_value();
+        }
+    }
+
+    void notify_drained() noexcept {
+        if (m_drained.empty() || size() > m_low_watermark) {
+            return;
+        }
+        for (auto &drained : std::exchange(m_drained, {})) {
+            drained.set_value();
+        }
+    }
+
+    std::size_t offset(const std::size_t position) const noexcept {
+        return position & (capacity() - 1);
+    }
+
+    void grow(const std::size_t required) {
+        if (required <= capacity()) {
+            return;
+        }
+
+        std::vector<ByteType> stream(std::bit_ceil(std::max(required, MIN_CAPACITY)));
+        const std::size_t count = ring_size();
+        std::size_t copied = 0;
+        for (const auto &span : readable_spans()) {
+            std::memcpy(stream.data() + copied, span.data(), span.size());
+            copied += span.size();
+        }
+
+        m_stream = std::move(stream);
+        m_begin  = 0;
+        m_end    = count;
     }
 };
 
@@ -99,8 +361,9 @@ private:
     friend class quic_stream<ByteType>;
 
 public:
-    void write(const ByteType *buffer, const std::size_t count) {
-        m_istream->write(buffer, count);
+    /** @return The number of bytes written, less than `count` if the stream's buffer is full. */
+    std::size_t write(const ByteType *buffer, const std::size_t count) {
+        return m_istream->write(buffer, count);
     }
 
     quic_istream(const quic_istream<ByteType>&) = default;
@@ -133,6 +396,12 @@ private:
     quic_ostream() = default;
 };
 
+/**
+ * @brief A reference to the buffers of a single QUIC stream.
+ *
+ * Copies share the stream; the buffers stay valid as long as any copy is
+ * alive, even after lsquic has closed the stream.
+ */
 template<typename ByteType = quic_stream_value_t>
     requires (sizeof(ByteType) == 1)
 class quic_stream {
@@ -140,6 +409,7 @@ public:
     using value_type = ByteType;
 
 private:
+    detail::base_quic_stream<ByteType>             *m_base    = nullptr;
     detail::one_directionial_quic_stream<ByteType> *m_istream = nullptr;
     detail::one_directionial_quic_stream<ByteType> *m_ostream = nullptr;
 
@@ -147,20 +417,164 @@ private:
     friend class detail::base_quic_stream<ByteType>;
 
 public:
-    void write(const ByteType *buffer, const std::size_t count) {
-        m_istream->write(buffer, count);
+    quic_stream(const quic_stream<ByteType> &other) noexcept
+    : m_base(other.m_base)
+    , m_istream(other.m_istream)
+    , m_ostream(other.m_ostream)
+    {
+        if (m_base) {
+            m_base->add_ref();
+        }
     }
 
-    void read(ByteType *buffer, const std::size_t count) {
-        m_ostream->read(buffer, count);
+    quic_stream(quic_stream<ByteType> &&other) noexcept
+    : m_base(std::exchange(other.m_base, nullptr))
+    , m_istream(std::exchange(other.m_istream, nullptr))
+    , m_ostream(std::exchange(other.m_ostream, nullptr)) {}
+
+    quic_stream<ByteType> &operator=(quic_stream<ByteType> other) noexcept {
+        std::swap(m_base, other.m_base);
+        std::swap(m_istream, other.m_istream);
+        std::swap(m_ostream, other.m_ostream);
+        return *this;
+    }
+
+    ~quic_stream() {
+        if (m_base) {
+            m_base->release();
+        }
+    }
+
+    /**
+     * @brief Writes `count` bytes, waiting for the other side to drain the
+     *        stream whenever the buffered data reaches the high watermark.
+     *
+     * `buffer` must stay valid until the returned future resolves. The future
+     * fails with `stream_closed_error` if lsquic closes the stream first.
+     */
+    seastar::future<> write(const ByteType *buffer, const std::size_t count) {
+        return seastar::repeat([stream = *this, buffer, count, written = std::size_t{0}] () mutable {
+            if (stream.closed()) {
+                return seastar::make_exception_future<seastar::stop_iteration>(stream_closed_error{});
+            }
+            if (written == count) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            if (stream.m_istream->above_high_watermark()) {
+                return stream.m_istream->wait_drained().then([] {
+                    return seastar::stop_iteration::no;
+                });
+            }
+
+            const std::size_t chunk = stream.try_write(buffer + written, count - written);
+            written += chunk;
+            if (!chunk) {
+                // The buffer is capped below the high watermark.
+                return stream.m_istream->wait_drained().then([] {
+                    return seastar::stop_iteration::no;
+                });
+            }
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+        });
+    }
+
+    /**
+     * @brief Queues `chunk` on the stream without copying it, after waiting for
+     *        the buffered data to drop below the high watermark.
+     *
+     * The future fails with `stream_closed_error` if lsquic closes the stream first.
+     */
+    seastar::future<> write(seastar::temporary_buffer<ByteType> chunk) {
+        if (closed()) {
+            return seastar::make_exception_future<>(stream_closed_error{});
+        }
+        if (!m_istream->above_high_watermark()) {
+            append(std::move(chunk));
+            return seastar::make_ready_future<>();
+        }
+
+        return m_istream->wait_drained().then([stream = *this, chunk = std::move(chunk)] () mutable {
+            return stream.write(std::move(chunk));
+        });
+    }
+
+    /**
+     * @brief Writes without waiting.
+     * @return The number of bytes written, less than `count` if the stream's buffer is full.
+     */
+    std::size_t try_write(const ByteType *buffer, const std::size_t count) {
+        const std::size_t written = m_istream->write(buffer, count);
+        if (written) {
+            m_base->notify_written();
+        }
+        return written;
+    }
+
+    /**
+     * @brief Waits for data and returns everything buffered at that point.
+     *
+     * An empty buffer means that the peer has finished the stream. The future
+     * fails with `stream_closed_error` if the stream is closed without that.
+     */
+    seastar::future<seastar::temporary_buffer<ByteType>> read() {
+        if (m_ostream->size()) {
+            seastar::temporary_buffer<ByteType> result(m_ostream->size());
+            try_read(result.get_write(), result.size());
+            return seastar::make_ready_future<seastar::temporary_buffer<ByteType>>(std::move(result));
+        }
+        if (m_ostream->eof()) {
+            return seastar::make_ready_future<seastar::temporary_buffer<ByteType>>();
+        }
+        if (closed()) {
+            return seastar::make_exception_future<seastar::temporary_buffer<ByteType>>(stream_closed_error{});
+        }
+
+        return m_ostream->wait_readable().then([stream = *this] () mutable {
+            return stream.read();
+        });
+    }
+
+    /**
+     * @brief Reads without waiting.
+     * @return The number of bytes read, less than `count` if fewer are buffered.
+     */
+    std::size_t try_read(ByteType *buffer, const std::size_t count) {
+        const std::size_t read = m_ostream->read_some(buffer, count);
+        if (read) {
+            m_base->notify_consumed();
+        }
+        return read;
+    }
+
+private:
+    void append(seastar::temporary_buffer<ByteType> chunk) {
+        m_istream->append(std::move(chunk));
+        m_base->notify_written();
+    }
+
+public:
+    /** @brief Returns the number of written bytes the other side hasn't consumed yet. */
+    std::size_t buffered() const noexcept {
+        return m_istream->size();
+    }
+
+    /** @brief Checks whether lsquic has closed the stream. */
+    bool closed() const noexcept {
+        return m_base->closed();
     }
 
+    /** @brief The returned object is valid as long as `*this` is. */
     quic_istream<ByteType> get_istream() noexcept {
-        return quic_istream<ByteType> { .m_istream = m_istream };
+        quic_istream<ByteType> result{};
+        result.m_istream = m_istream;
+        return result;
     }
 
+    /** @brief The returned object is valid as long as `*this` is. */
     quic_ostream<ByteType> get_ostream() noexcept {
-        return quic_ostream<ByteType> { .m_ostream = m_ostream };
+        quic_ostream<ByteType> result{};
+        result.m_ostream = m_ostream;
+        return result;
     }
 
 private:
@@ -173,27 +587,115 @@ template<typename ByteType>
     requires (sizeof(ByteType) == 1)
 class base_quic_stream {
 public:
-    using value_type = ByteType;
+    using value_type    = ByteType;
+    using disposer_t    = void (*)(base_quic_stream<ByteType>*) noexcept;
+    using hook_t        = void (*)(base_quic_stream<ByteType>*) noexcept;
 
 private:
     one_directionial_quic_stream<ByteType> m_istream{};
     one_directionial_quic_stream<ByteType> m_ostream{};
+    unsigned                               m_refs       = 1;
+    bool                                   m_closed     = false;
+    disposer_t                             m_disposer   = nullptr;
+    hook_t                                 m_on_written = nullptr;
+    hook_t                                 m_on_consumed = nullptr;
 
 private:
     friend void ::zpp::quic::detail::on_read(lsquic_stream_t*, lsquic_stream_ctx_t*);
     friend void ::zpp::quic::detail::on_write(lsquic_stream_t*, lsquic_stream_ctx_t*);
 
 public:
-    void write(const ByteType *buffer, const std::size_t count) {
-        m_istream.write(buffer, count);
+    base_quic_stream() = default;
+
+    /** @brief `disposer` is called instead of `delete` when the last reference is dropped. */
+    explicit base_quic_stream(disposer_t disposer) noexcept
+    : m_disposer(disposer) {}
+
+    base_quic_stream(const base_quic_stream<ByteType>&) = delete;
+    base_quic_stream<ByteType> &operator=(const base_quic_stream<ByteType>&) = delete;
+
+    std::size_t write(const ByteType *buffer, const std::size_t count) {
+        const std::size_t written = m_istream.write(buffer, count);
+        if (written) {
+            notify_written();
+        }
+        return written;
     }
 
     void read(ByteType *buffer, const std::size_t count) {
         m_ostream.read(buffer, count);
     }
 
+    /** @brief Caps the buffer of each direction at `max_capacity` bytes. */
+    void set_max_buffer_size(const std::size_t max_capacity) {
+        m_istream.set_max_capacity(max_capacity);
+        m_ostream.set_max_capacity(max_capacity);
+    }
+
+    /** @brief Sets the levels between which writers are paused, for both directions. */
+    void set_watermarks(const std::size_t low, const std::size_t high) noexcept {
+        m_istream.set_watermarks(low, high);
+        m_ostream.set_watermarks(low, high);
+    }
+
+    /**
+     * @brief `written` is called whenever new data is written through a
+     *        `quic_stream`, `consumed` whenever data is read through one.
+     */
+    void set_hooks(hook_t written, hook_t consumed) noexcept {
+        m_on_written  = written;
+        m_on_consumed = consumed;
+    }
+
+    void notify_written() noexcept {
+        if (m_on_written) {
+            m_on_written(this);
+        }
+    }
+
+    void notify_consumed() noexcept {
+        if (m_on_consumed) {
+            m_on_consumed(this);
+        }
+    }
+
+    void add_ref() noexcept {
+        ++m_refs;
+    }
+
+    /** @brief Drops a reference. The object is disposed of with the last one. */
+    void release() noexcept {
+        if (--m_refs) {
+            return;
+        }
+
+        if (m_disposer) {
+            m_disposer(this);
+        } else {
+            delete this;
+        }
+    }
+
+    bool closed() const noexcept {
+        return m_closed;
+    }
+
+    /** @brief Bytes waiting in both directions, whether in the ring or in queued chunks. */
+    std::size_t buffered_bytes() const noexcept {
+        return m_istream.size() + m_ostream.size();
+    }
+
+    /** @brief Fails the writers waiting on the stream. */
+    void mark_closed() noexcept {
+        m_closed = true;
+        m_istream.abort(std::make_exception_ptr(stream_closed_error{}));
+        m_ostream.abort(std::make_exception_ptr(stream_closed_error{}));
+    }
+
     quic_stream<ByteType> get_wrapper() noexcept {
         quic_stream<ByteType> result{};
+        add_ref();
+        result.m_base    = this;
         result.m_istream = std::addressof(m_istream);
         result.m_ostream = std::addressof(m_ostream);
         return result;
@@ -201,10 +703,15 @@ public:
 
     quic_stream<ByteType> get_reversed_wrapper() noexcept {
         quic_stream<ByteType> result{};
+        add_ref();
+        result.m_base    = this;
         result.m_istream = std::addressof(m_ostream);
         result.m_ostream = std::addressof(m_istream);
         return result;
     }
+
+protected:
+    ~base_quic_stream() = default;
 };
 
 } // namespace detail
@@ -0,0 +1,76 @@
+#ifndef __QUIC_FILEHOST_QUIC_REMOTE_QUIC_STREAM_HH__
+#define __QUIC_FILEHOST_QUIC_REMOTE_QUIC_STREAM_HH__
+
+#include <seastar/core/future.hh>
+#include <seastar/core/sharded.hh>  // seastar::foreign_ptr
+#include <seastar/core/smp.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <quic/common.hh>
+#include <quic/quic_stream.hh>
+
+#include <cstddef>
+#include <memory>
+
+namespace zpp {
+namespace quic {
+
+/**
+ * @brief A `quic_stream` that can be used from a shard other than the one
+ *        serving it.
+ *
+ * The stream itself never leaves its shard: every operation is shipped to the
+ * owner over seastar's inter-shard queues (one lock-free SPSC ring per pair of
+ * shards) and the wrapper is destroyed there as well, so the stream's
+ * non-atomic reference count is only ever touched by one thread.
+ *
+ * The object must be kept alive until the futures it has returned resolve.
+ */
+template<typename ByteType = quic_stream_value_t>
+    requires (sizeof(ByteType) == 1)
+class remote_quic_stream {
+public:
+    using value_type = ByteType;
+
+    struct status {
+        bool        closed;
+        /** Bytes written but not yet consumed by lsquic. */
+        std::size_t buffered;
+    };
+
+private:
+    seastar::foreign_ptr<std::unique_ptr<quic_stream<ByteType>>> m_stream;
+
+public:
+    /** @brief Has to be called on the shard serving `stream`. */
+    explicit remote_quic_stream(quic_stream<ByteType> stream)
+    : m_stream(seastar::make_foreign(std::make_unique<quic_stream<ByteType>>(std::move(stream)))) {}
+
+    remote_quic_stream(remote_quic_stream<ByteType>&&) noexcept = default;
+    remote_quic_stream<ByteType> &operator=(remote_quic_stream<ByteType>&&) noexcept = default;
+
+    unsigned shard() const noexcept {
+        return m_stream.get_owner_shard();
+    }
+
+    /**
+     * @brief Moves `chunk` over to the serving shard and queues it on the stream
+     *        there without copying. See `quic_stream::write`.
+     */
+    seastar::future<> write(seastar::temporary_buffer<ByteType> chunk) {
+        return seastar::smp::submit_to(shard(), [stream = m_stream.get(), chunk = std::move(chunk)] () mutable {
+            return stream->write(std::move(chunk));
+        });
+    }
+
+    seastar::future<status> get_status() const {
+        return seastar::smp::submit_to(shard(), [stream = m_stream.get()] {
+            return status{ .closed = stream->closed(), .buffered = stream->buffered() };
+        });
+    }
+};
+
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_REMOTE_QUIC_STREAM_HH__
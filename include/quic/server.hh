@@ -1,7 +1,11 @@
 #ifndef __QUIC_FILEHOST_QUIC_SERVER_HH__
 #define __QUIC_FILEHOST_QUIC_SERVER_HH__
 
+#include <seastar/core/circular_buffer.hh>
 #include <seastar/core/future.hh>
+#include <seastar/core/lowres_clock.hh>
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/core/queue.hh>
 #include <seastar/core/seastar.hh>
 #include <seastar/core/timer.hh>
 #include <seastar/net/api.hh>
@@ -10,57 +14,344 @@
 
 #include <quic/common.hh>
 #include <quic/quic_stream.hh>
+#include <quic/server_config.hh>
+#include <quic/detail/admission_control.hh>
 #include <quic/detail/callbacks.hh>
+#include <quic/detail/connection_registry.hh>
+#include <quic/detail/handoff.hh>
+#include <quic/detail/histogram.hh>
+#include <quic/detail/packet_memory.hh>
+#include <quic/detail/transport_stats.hh>
+#include <quic/detail/udp_socket.hh>
+
+#include <algorithm>  // std::max
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <utility>    // std::pair
+#include <vector>
 
 namespace zpp {
 namespace quic {
 
+/** @brief Reported to `server::accept` once the server has started to stop. */
+class server_stopped_error : public std::runtime_error {
+public:
+    server_stopped_error()
+    : std::runtime_error("The QUIC server has been stopped.") {}
+};
+
+/** @brief How many datagrams may be fed to the engine before it is ticked. */
+struct receive_batching {
+    /** Upper bound on the datagrams in a batch. 1 ticks after every datagram. */
+    std::size_t                 max_datagrams   = 64;
+    /** Time after which a batch is closed even if more datagrams are queued. */
+    std::chrono::microseconds   time_budget     = std::chrono::microseconds(500);
+};
+
+/** @brief How datagrams get to and from the kernel. */
+enum class udp_backend {
+    /** seastar's `udp_channel`, a syscall per datagram. */
+    channel,
+    /** A socket of our own, batching syscalls with `sendmmsg`/`recvmmsg` and UDP GSO/GRO. */
+    mmsg
+};
+
+struct udp_options {
+    udp_backend                 backend         = udp_backend::channel;
+    /** Merge datagrams into GSO sends; only used by `udp_backend::mmsg`. */
+    bool                        gso             = true;
+    /** Receive datagrams coalesced by UDP GRO; only used by `udp_backend::mmsg`. */
+    bool                        gro             = true;
+    /** A bound socket to use instead of binding one, e.g. taken over from another process; only used by `udp_backend::mmsg`. */
+    int                         socket_fd       = -1;
+};
+
 class server {
+private:
+    using batch_histogram_t = detail::log2_histogram<8>;
+    /** Microseconds, up to about a second. */
+    using tick_histogram_t  = detail::log2_histogram<20>;
+    using tick_clock        = seastar::timer<>::clock;
+
 private:
     seastar::net::udp_channel                       m_channel;
-    seastar::future<>                               m_udp_send_queue;
+    /** Replaces `m_channel` with `udp_backend::mmsg`. */
+    std::optional<detail::udp_socket>               m_socket;
+    seastar::circular_buffer<detail::outgoing_datagram> m_udp_send_queue{};
+    /** Sends the queued datagrams one at a time; resolved when the queue is empty. */
+    seastar::future<>                               m_udp_sender;
+    /** Set from the start of `m_udp_sender` until it has found the queue empty. */
+    bool                                            m_sending           = false;
+    std::size_t                                     m_max_queued_sends  = DEFAULT_SEND_QUEUE_SIZE;
+    /** Set when lsquic has been told to back off and waits for `lsquic_engine_send_unsent_packets`. */
+    bool                                            m_sends_blocked     = false;
     seastar::timer<>                                m_timer;
+    /** Set while a tick requested with `schedule_tick` has not run yet. */
+    bool                                            m_tick_pending      = false;
     lsquic_engine_t                                *m_engine            = nullptr;
-    detail::base_quic_stream<quic_stream_value_t>  *m_stream            = nullptr;
+    server_config                                   m_engine_config{};
+    detail::packet_memory                           m_packet_memory{};
+    detail::connection_registry                     m_connections{};
+    seastar::queue<quic_stream<quic_stream_value_t>> m_accepted;
+    receive_batching                                m_batching{};
+    std::optional<seastar::future<seastar::net::udp_datagram>> m_pending_receive{};
+    batch_histogram_t                               m_batch_sizes{};
+    std::size_t                                     m_forwards_in_flight = 0;
+    std::uint64_t                                   m_forwarded_out     = 0;
+    std::uint64_t                                   m_forwarded_in      = 0;
+    std::uint64_t                                   m_forward_drops     = 0;
+    std::uint64_t                                   m_send_backoffs     = 0;
+    std::uint64_t                                   m_packets_in        = 0;
+    std::uint64_t                                   m_bytes_in          = 0;
+    std::uint64_t                                   m_packets_out       = 0;
+    std::uint64_t                                   m_bytes_out         = 0;
+    /** Outcomes of `lsquic_engine_packet_in`: processed by a connection, processed without one, failed. */
+    std::uint64_t                                   m_packets_to_connection     = 0;
+    std::uint64_t                                   m_packets_to_no_connection  = 0;
+    std::uint64_t                                   m_packets_failed            = 0;
+    std::uint64_t                                   m_engine_ticks      = 0;
+    tick_histogram_t                                m_tick_durations{};
+    detail::transport_stats                         m_transport_stats{};
+    detail::admission_control                       m_admission{};
+    std::size_t                                     m_handshake_threshold = 0;
+    std::chrono::seconds                            m_validated_ttl     = DEFAULT_VALIDATED_TTL;
+    /** Samples `lsquic_conn_get_info` of every connection; disabled by a zero period. */
+    seastar::timer<seastar::lowres_clock>           m_stats_sampler{};
+    std::chrono::milliseconds                       m_stats_period      = DEFAULT_STATS_PERIOD;
+    seastar::metrics::metric_groups                 m_metrics{};
+    /** Set once `stop` has been called; new connections and streams are closed right away. */
+    bool                                            m_stopping          = false;
+    /** Set once `stop` no longer needs datagrams; ends the receive loop. */
+    bool                                            m_input_closed      = false;
+    /** Resolves `service_loop` once the engine has been destroyed. */
+    seastar::promise<>                              m_stopped{};
+    /** Set once the socket has been handed over to a successor, which relays our datagrams. */
+    bool                                            m_handed_over       = false;
+    /** Receives the datagrams a successor relays to this process. */
+    std::optional<detail::datagram_relay>           m_relay_in{};
+    seastar::future<>                               m_relay_receiver    = seastar::make_ready_future<>();
+    /** Relays the datagrams of the predecessor's connections to its shards, until it's gone. */
+    std::optional<detail::datagram_relay>           m_relay_out{};
+    /** The relay of every shard of the predecessor, and whether that shard has drained. */
+    std::vector<std::pair<sockaddr_un, bool>>       m_predecessor{};
+    std::size_t                                     m_predecessor_shards_left = 0;
+    std::uint64_t                                   m_relayed_out       = 0;
+    std::uint64_t                                   m_relayed_in        = 0;
+    std::uint64_t                                   m_relay_drops       = 0;
+
+    static constexpr std::size_t ACCEPT_QUEUE_SIZE = 1024;
+    /** A timer armed this close to the wanted deadline is left alone. */
+    static constexpr std::chrono::microseconds TIMER_SLACK{50};
+    /** How often `stop` checks whether the streams have finished. */
+    static constexpr std::chrono::milliseconds DRAIN_POLL_PERIOD{10};
+    /** How long closed connections get to send CONNECTION_CLOSE before the engine is destroyed. */
+    static constexpr std::chrono::milliseconds CLOSE_TIMEOUT{500};
 
 private:
-    friend int ::zpp::quic::detail::packets_out(void*, const lsquic_out_spec*, unsigned int);
+    friend lsquic_conn_ctx_t   *::zpp::quic::detail::on_new_connection(void*, lsquic_conn_t*);
+    friend lsquic_stream_ctx_t *::zpp::quic::detail::on_new_stream(void*, lsquic_stream*);
+    friend int   ::zpp::quic::detail::packets_out(void*, const lsquic_out_spec*, unsigned int);
+    friend void *::zpp::quic::detail::packet_allocate(void*, void*, lsquic_conn_ctx_t*, unsigned short, char);
+    friend void  ::zpp::quic::detail::packet_release(void*, void*, void*, char);
 
 public:
-    server(std::uint16_t port)
-    : m_channel(seastar::make_udp_channel(port))
-    , m_udp_send_queue(seastar::make_ready_future<>())
-    , m_timer() {}
+    static constexpr std::size_t DEFAULT_SEND_QUEUE_SIZE = 512;
+    static constexpr std::chrono::milliseconds DEFAULT_STATS_PERIOD{1000};
+    static constexpr std::chrono::seconds DEFAULT_VALIDATED_TTL{600};
+    static constexpr std::chrono::milliseconds DEFAULT_DRAIN_TIMEOUT{10000};
+
+    server(std::uint16_t port, const udp_options &udp = {})
+    : m_channel(udp.backend == udp_backend::channel ? seastar::make_udp_channel(port) : seastar::net::udp_channel{})
+    , m_socket(udp.backend == udp_backend::mmsg ? make_socket(port, udp) : std::nullopt)
+    , m_udp_sender(seastar::make_ready_future<>())
+    , m_timer()
+    , m_accepted(ACCEPT_QUEUE_SIZE) {}
 
     server(server &&other)
     : m_channel(std::move(other.m_channel))
+    , m_socket(std::move(other.m_socket))
     , m_udp_send_queue(std::move(other.m_udp_send_queue))
-    , m_timer(std::move(other.m_timer)) {}
+    , m_udp_sender(std::move(other.m_udp_sender))
+    , m_sending(other.m_sending)
+    , m_max_queued_sends(other.m_max_queued_sends)
+    , m_sends_blocked(other.m_sends_blocked)
+    , m_timer(std::move(other.m_timer))
+    , m_tick_pending(other.m_tick_pending)
+    , m_engine_config(std::move(other.m_engine_config))
+    , m_packet_memory(std::move(other.m_packet_memory))
+    , m_connections(std::move(other.m_connections))
+    , m_accepted(std::move(other.m_accepted))
+    , m_batching(other.m_batching)
+    , m_pending_receive(std::move(other.m_pending_receive))
+    , m_batch_sizes(other.m_batch_sizes)
+    , m_transport_stats(std::move(other.m_transport_stats))
+    , m_stats_period(other.m_stats_period)
+    , m_handshake_threshold(other.m_handshake_threshold)
+    , m_validated_ttl(other.m_validated_ttl) {}
 
     // I myself can't believe what's going on in here...
     server &operator=(server &&other) {
         m_channel = std::move(other.m_channel);
+        m_socket = std::move(other.m_socket);
         m_udp_send_queue = std::move(other.m_udp_send_queue);
+        m_udp_sender = std::move(other.m_udp_sender);
+        m_sending = other.m_sending;
+        m_max_queued_sends = other.m_max_queued_sends;
+        m_sends_blocked = other.m_sends_blocked;
+        m_tick_pending = other.m_tick_pending;
+        m_engine_config = std::move(other.m_engine_config);
+        m_packet_memory = std::move(other.m_packet_memory);
+        m_connections = std::move(other.m_connections);
+        m_accepted = std::move(other.m_accepted);
+        m_batching = other.m_batching;
+        m_pending_receive = std::move(other.m_pending_receive);
+        m_batch_sizes = other.m_batch_sizes;
+        m_transport_stats = std::move(other.m_transport_stats);
+        m_stats_period = other.m_stats_period;
+        m_handshake_threshold = other.m_handshake_threshold;
+        m_validated_ttl = other.m_validated_ttl;
 
         m_timer.~timer<>();
         new (std::addressof(m_timer)) seastar::timer<>{std::move(other.m_timer)};
 
-        m_stream->~base_quic_stream<quic_stream_value_t>();
-        m_stream = std::exchange(other.m_stream, nullptr);
-
         return *this;
     }
 
     ~server();
 
-    /** @brief Passes the ownership of `stream` on to the object. */
-    void                init_lsquic(detail::base_quic_stream<quic_stream_value_t> *stream);
-    seastar::future<>   service_loop(quic_stream<quic_stream_value_t> stream);
+    /** @brief Applies to the engine created by `init_lsquic`. */
+    void set_engine_config(const server_config &config) {
+        m_engine_config = config;
+    }
+
+    /** @brief The object must not be moved after this call. */
+    void                init_lsquic();
+    /** @brief Receives datagrams until the server has been stopped. */
+    seastar::future<>   service_loop();
+
+    /**
+     * @brief Shuts the server down without truncating transfers in flight.
+     *
+     * New connections and streams are refused and the peers of gQUIC
+     * connections are sent GOAWAY. The engine keeps ticking until every
+     * stream has finished or `drain_timeout` has passed, then the remaining
+     * connections are closed with CONNECTION_CLOSE, the send queue is flushed
+     * and the engine is destroyed. `service_loop` resolves afterwards.
+     */
+    seastar::future<>   stop(const std::chrono::milliseconds drain_timeout = DEFAULT_DRAIN_TIMEOUT);
+
+    /** @brief Waits for a peer to open a new stream; fails with `server_stopped_error` once stopping. */
+    seastar::future<quic_stream<quic_stream_value_t>> accept() {
+        return m_accepted.pop_eventually();
+    }
+
+    void set_receive_batching(const receive_batching &batching) noexcept {
+        m_batching = batching;
+    }
+
+    /** @brief Caps the memory held by each direction of every stream opened from now on. */
+    void set_max_stream_buffer(const std::size_t size) noexcept {
+        m_connections.set_max_stream_buffer(size);
+    }
+
+    /** @brief Writers of streams opened from now on wait at `high` buffered bytes until lsquic drains them to `low`. */
+    void set_stream_watermarks(const std::size_t low, const std::size_t high) noexcept {
+        m_connections.set_stream_watermarks(low, high);
+    }
+
+    /** @brief Bounds the datagrams waiting to be sent; lsquic is told to back off beyond that. */
+    void set_send_queue_size(const std::size_t size) noexcept {
+        m_max_queued_sends = std::max<std::size_t>(1, size);
+    }
+
+    /** @brief How often the transport state of every connection is sampled; zero only records closed ones. */
+    void set_stats_period(const std::chrono::milliseconds period) noexcept {
+        m_stats_period = period;
+    }
+
+    /**
+     * @brief Once `threshold` handshakes are in flight on a shard, Initials
+     *        are only let in from addresses that have completed a handshake
+     *        in the last `validated_ttl`. 0 lets every Initial in.
+     */
+    void set_handshake_admission(const std::size_t threshold, const std::chrono::seconds validated_ttl) noexcept {
+        m_handshake_threshold = threshold;
+        m_validated_ttl       = validated_ttl;
+    }
+
+    /** @brief The socket of the shard, or -1 with `udp_backend::channel`. */
+    int socket_fd() const noexcept {
+        return m_socket ? m_socket->native_handle() : -1;
+    }
+
+    /**
+     * @brief Receives the datagrams a successor relays to this shard, which
+     *        it does once the socket has been handed over with `hand_over_input`.
+     *        `path` is the handoff socket. Call it after `init_lsquic`.
+     */
+    void                accept_relayed(const std::string &path);
+
+    /**
+     * @brief Relays the datagrams of connections issued by the `generation`
+     *        of the process this one has taken the socket over from, until it
+     *        has stopped. Call it after `init_lsquic`.
+     */
+    void                relay_to_predecessor(const std::string &path, const std::uint8_t generation);
+
+    /** @brief Stops reading the socket, which a successor reads from now on. */
+    void                hand_over_input();
+
+    /** @brief Appends the transport state of every closed connection to `path` as a JSON line. */
+    void dump_connection_stats(const std::string &path) {
+        m_transport_stats.dump_to(path);
+    }
 
 private:
-    seastar::future<>   timer_expired();
-    seastar::future<>   process_connections();
-    seastar::future<>   handle_receive(seastar::net::udp_datagram &&datagram);
+    static std::optional<detail::udp_socket> make_socket(const std::uint16_t port, const udp_options &udp);
+    seastar::future<>   receive_relayed();
+    void                relay_datagram(const unsigned shard, const unsigned char *data, const std::size_t size,
+                                       const seastar::socket_address &src, const int ecn);
+    void                timer_expired();
+    /**
+     * @brief Makes the engine tick as soon as possible, outside of the current task.
+     *        Requests made before the tick runs are served by that one tick.
+     */
+    void                schedule_tick();
+    /** @brief Ticks the engine and arms the timer for its next deadline. */
+    void                process_connections();
+    void                rearm_timer(const tick_clock::time_point deadline);
+    seastar::future<>   receive_batch();
+    seastar::future<>   receive_socket_batch();
+    void                handle_receive(seastar::net::udp_datagram &&datagram);
+    void                handle_datagram(const unsigned char *data, const std::size_t size, const seastar::socket_address &src,
+                                        const int ecn);
+    seastar::socket_address local_address() const {
+        return m_socket ? m_socket->local_address() : m_channel.local_address();
+    }
+    /** @brief Hands a datagram over to the shard owning its connection. */
+    void                forward_datagram(const unsigned shard, const unsigned char *data, const std::size_t size,
+                                         const seastar::socket_address &src, const int ecn);
+    bool send_queue_full() const noexcept {
+        return m_udp_send_queue.size() >= m_max_queued_sends;
+    }
+
+    void                queue_datagram(const seastar::socket_address &destination, seastar::net::packet &&packet);
+    seastar::future<>   flush_send_queue();
+    seastar::future<>   flush_to_channel();
+    /** @param ecn The ECN bits of the datagram's IP header, 0 if unknown. */
+    void                feed_packet(const unsigned char *data, const std::size_t size, const seastar::socket_address &src,
+                                    const int ecn);
+    void                register_metrics();
+    void                sample_connections();
+    /** @brief Stops the receive loop, dropping a receive it has left pending. */
+    void                close_input();
+    /** @brief Resolves once `done` holds or `deadline` has passed, checking every `DRAIN_POLL_PERIOD`. */
+    template<typename Done>
+    seastar::future<>   wait_until(Done &&done, const seastar::lowres_clock::time_point deadline);
 };
 
 } // namespace quic
@@ -0,0 +1,83 @@
+#ifndef __QUIC_FILEHOST_QUIC_SERVER_CONFIG_HH__
+#define __QUIC_FILEHOST_QUIC_SERVER_CONFIG_HH__
+
+#include <lsquic/lsquic.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace zpp {
+namespace quic {
+
+/** Values of `lsquic_engine_settings::es_cc_algo`. */
+enum class congestion_control : unsigned {
+    cubic       = 1,
+    bbr         = 2,
+    /** BBR, switching to Cubic on paths with a low RTT. */
+    adaptive    = 3
+};
+
+/** @brief A malformed option, profile name or configuration file. */
+class config_error : public std::invalid_argument {
+public:
+    using std::invalid_argument::invalid_argument;
+};
+
+/**
+ * @brief Tunables of the lsquic engine of every shard.
+ *
+ * Settings left unset keep lsquic's defaults. A configuration is usually
+ * built from a named profile, then a file and then single `key=value`
+ * options, each overriding the previous ones.
+ */
+struct server_config {
+    /** Initial connection and stream flow-control windows, in bytes. */
+    std::optional<std::uint32_t>    connection_window{};
+    std::optional<std::uint32_t>    stream_window{};
+    /** Limits auto-tuning may grow the windows to, in bytes. */
+    std::optional<std::uint32_t>    max_connection_window{};
+    std::optional<std::uint32_t>    max_stream_window{};
+    /** Bidirectional streams a peer may open at once. */
+    std::optional<std::uint32_t>    max_streams{};
+    std::optional<congestion_control> congestion{};
+    std::optional<bool>             pacing{};
+    std::optional<bool>             ecn{};
+    std::optional<std::chrono::seconds>      idle_timeout{};
+    std::optional<std::chrono::microseconds> handshake_timeout{};
+    /** Connections that may be in the middle of a handshake at once. */
+    std::optional<std::uint32_t>    max_handshaking{};
+
+    /** @brief Names accepted by `profile`. */
+    static constexpr std::string_view PROFILES = "default, bulk-throughput, low-latency";
+
+    /** @throws config_error if there's no such profile. */
+    static server_config profile(std::string_view name);
+
+    /**
+     * @brief Sets a single option, e.g. `apply("stream-window", "1048576")`.
+     * @throws config_error if the key is unknown or the value doesn't parse.
+     */
+    void apply(std::string_view key, std::string_view value);
+    /** @brief Applies a `key=value` pair. */
+    void apply(std::string_view option);
+    /**
+     * @brief Applies a file of `key = value` lines. Blank lines and lines
+     *        starting with `#` are skipped.
+     */
+    void apply_file(const std::string &path);
+
+    /** @brief Overrides `settings`, which lsquic has already filled with its defaults. */
+    void fill(lsquic_engine_settings &settings) const noexcept;
+
+    /** @return lsquic's complaint about the resulting settings, or nothing if they are valid. */
+    std::optional<std::string> check() const;
+};
+
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_SERVER_CONFIG_HH__
@@ -0,0 +1,80 @@
+#ifndef __QUIC_FILEHOST_QUIC_SSL_CERTIFICATE_STORE_HH__
+#define __QUIC_FILEHOST_QUIC_SSL_CERTIFICATE_STORE_HH__
+
+#include <seastar/core/future.hh>
+
+#include <openssl/ssl.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zpp {
+namespace quic {
+namespace ssl {
+
+/** @brief A certificate directory that can't be loaded. */
+class certificate_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Server contexts of every certificate in a directory, keyed by the
+ *        names they serve.
+ *
+ * The directory holds `<name>-cert.pem` and `<name>-key.pem` pairs. Each
+ * certificate serves the DNS names of its subjectAltName extension, or its
+ * common name if it has none; `*.example.com` serves any single label under
+ * `example.com`. A store is immutable once loaded, so a single one is shared
+ * by every shard, and replaced as a whole on reload. Connections keep the
+ * contexts they have started with.
+ */
+class certificate_store {
+private:
+    std::vector<SSL_CTX*>                       m_contexts{};
+    std::unordered_map<std::string, SSL_CTX*>   m_by_name{};
+    SSL_CTX                                    *m_default   = nullptr;
+
+public:
+    certificate_store() = default;
+    certificate_store(const certificate_store&) = delete;
+    certificate_store &operator=(const certificate_store&) = delete;
+    ~certificate_store();
+
+    /**
+     * @param default_name The `<name>` of the pair used for clients sending no
+     *        known server name; the first pair by name if empty.
+     * @throws certificate_error if the directory or any pair in it can't be loaded.
+     */
+    static std::shared_ptr<const certificate_store> load(const std::string &directory, const std::string &default_name);
+
+    SSL_CTX *default_context() const noexcept {
+        return m_default;
+    }
+
+    /** @return The context serving `sni`, or the default one. */
+    SSL_CTX *find(const char *sni) const noexcept;
+
+    std::size_t size() const noexcept {
+        return m_contexts.size();
+    }
+};
+
+/** @brief The store used by the calling shard, if any has been installed. */
+const certificate_store *local_certificates() noexcept;
+
+/**
+ * @brief Loads the certificates of `directory` once, on the calling shard, and
+ *        installs them on every shard. A store that fails to load leaves the
+ *        previous one in place.
+ */
+seastar::future<> install_certificates(const std::string &directory, const std::string &default_name);
+
+} // namespace ssl
+} // namespace quic
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_QUIC_SSL_CERTIFICATE_STORE_HH__
@@ -1,12 +1,63 @@
 #ifndef __QUIC_FILEHOST_QUIC_DETAIL_SSL_HANDLER_HH__
 #define __QUIC_FILEHOST_QUIC_DETAIL_SSL_HANDLER_HH__
 
+#include <lsquic/lsquic.h>
+
 #include <openssl/ssl.h>
 
+#include <chrono>
+#include <cstdint>
+
 namespace zpp {
 namespace quic {
 namespace ssl {
 
+/** @brief What to do with 0-RTT data sent with a resumed session. */
+enum class early_data_policy {
+    /** Never accept 0-RTT data. */
+    disabled,
+    /**
+     * Accept 0-RTT data, but let every ticket resume a single session, so a
+     * replayed ClientHello falls back to a full handshake (RFC 8446, 8.1).
+     */
+    single_use,
+    /** Accept 0-RTT data with any valid ticket. Only for idempotent protocols. */
+    replayable
+};
+
+struct session_options {
+    bool                    tickets         = true;
+    /** How long a client may keep resuming with a ticket. */
+    std::chrono::seconds    ticket_lifetime = std::chrono::hours(2);
+    /**
+     * How often a new ticket key is generated. The previous key still
+     * decrypts tickets, so a ticket outlives at most two rotation periods.
+     */
+    std::chrono::seconds    key_rotation    = std::chrono::hours(1);
+    early_data_policy       early_data      = early_data_policy::single_use;
+};
+
+/** @brief Counts the kinds of handshakes completed by a single engine. */
+struct handshake_stats {
+    std::uint64_t full                  = 0;
+    std::uint64_t resumed               = 0;
+    std::uint64_t failed                = 0;
+    std::uint64_t early_data_accepted   = 0;
+    /** 0-RTT data offered by the client but refused by the server. */
+    std::uint64_t early_data_rejected   = 0;
+
+    /** @brief Records a connection from its `on_hsk_done`. */
+    void record(lsquic_conn_t *connection, lsquic_hsk_status status) noexcept;
+};
+
+/**
+ * @brief Sets up session resumption for the contexts loaded from now on.
+ *
+ * Ticket keys live in a single store shared by every shard, so a ticket
+ * issued by one shard resumes a session on any other one.
+ */
+void configure_sessions(const session_options &options);
+
 int load_cert(const char *cert_file, const char *key_file, SSL_CTX **ssl_ctx);
 
 } // namespace ssl
@@ -0,0 +1,184 @@
+#ifndef __QUIC_FILEHOST_UTILS_LOG_RING_HH__
+#define __QUIC_FILEHOST_UTILS_LOG_RING_HH__
+
+#include <cstddef>      // std::size_t, std::max_align_t
+#include <cstdint>      // std::uint64_t
+#include <memory>       // std::unique_ptr
+#include <new>          // placement new
+#include <ostream>      // std::ostream
+#include <sstream>      // std::ostringstream
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>      // std::forward, std::exchange
+
+namespace zpp {
+namespace logger {
+
+/** Severity of a record. The order matters: a threshold lets through itself and everything above. */
+enum class level : int {
+    trace   = 0,
+    debug   = 1,
+    info    = 2,
+    error   = 3
+};
+
+namespace detail {
+
+/** Where a record has been logged from. Every pointer refers to static storage. */
+struct location {
+    const char     *file;
+    const char     *function;
+    unsigned        line;
+};
+
+template<typename T>
+struct captured {
+    using raw = std::remove_cvref_t<T>;
+
+    // Arrays are string literals or `__func__`, which outlive the record.
+    // Any other string may be gone, or overwritten like `std::strerror`'s,
+    // by the time the record is formatted.
+    static constexpr bool is_string = std::is_same_v<raw, char*> || std::is_same_v<raw, const char*>
+            || std::is_same_v<raw, std::string_view>;
+
+    using type = std::conditional_t<!std::is_array_v<std::remove_reference_t<T>> && is_string,
+            std::string, std::decay_t<T>>;
+};
+
+template<typename T>
+using captured_t = typename captured<T>::type;
+
+} // namespace detail
+
+/**
+ * @brief A fixed-size queue of records waiting to be formatted.
+ *
+ * The arguments of a record are stored as they are and only formatted by
+ * `flush`, so logging costs a copy of the arguments. A ring is owned by a
+ * single shard and needs no synchronisation. Records that don't fit are
+ * dropped and counted.
+ */
+class ring {
+private:
+    static constexpr std::size_t STORAGE_SIZE = 64;
+
+    struct entry {
+        level               lvl;
+        detail::location    where;
+        void              (*print)(std::ostream&, void*);
+        void              (*destroy)(void*);
+        alignas(std::max_align_t) unsigned char storage[STORAGE_SIZE];
+    };
+
+    std::unique_ptr<entry[]>    m_entries;
+    std::size_t                 m_mask;
+    /** Monotonic positions; `m_tail - m_head` records are queued. */
+    std::size_t                 m_head      = 0;
+    std::size_t                 m_tail      = 0;
+    std::uint64_t               m_dropped   = 0;
+
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 1024;
+
+    /** @param capacity Rounded up to a power of two. */
+    explicit ring(std::size_t capacity = DEFAULT_CAPACITY)
+    : m_entries(nullptr)
+    , m_mask(0)
+    {
+        std::size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_entries.reset(new entry[size]);
+        m_mask = size - 1;
+    }
+
+    ring(const ring&) = delete;
+    ring &operator=(const ring&) = delete;
+
+    ~ring() {
+        while (m_head != m_tail) {
+            entry &e = m_entries[m_head++ & m_mask];
+            e.destroy(e.storage);
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return m_tail - m_head;
+    }
+
+    std::size_t capacity() const noexcept {
+        return m_mask + 1;
+    }
+
+    std::uint64_t dropped() const noexcept {
+        return m_dropped;
+    }
+
+    template<typename... Ts>
+    bool push(const level lvl, const detail::location &where, Ts &&...ts) {
+        if (size() == capacity()) {
+            ++m_dropped;
+            return false;
+        }
+
+        using args_t = std::tuple<detail::captured_t<Ts>...>;
+        entry &e = m_entries[m_tail & m_mask];
+        e.lvl   = lvl;
+        e.where = where;
+
+        if constexpr (sizeof(args_t) <= STORAGE_SIZE && alignof(args_t) <= alignof(std::max_align_t)) {
+            emplace<args_t>(e, std::forward<Ts>(ts)...);
+        } else {
+            // Too big to be kept as it is; pay for the formatting now.
+            std::ostringstream message;
+            (message << ... << std::forward<Ts>(ts));
+            emplace<std::tuple<std::string>>(e, std::move(message).str());
+        }
+
+        ++m_tail;
+        return true;
+    }
+
+    /** @brief Formats the queued records, errors to `elog` and the rest to `log`. */
+    void flush(std::ostream &log, std::ostream &elog) {
+        while (m_head != m_tail) {
+            entry &e = m_entries[m_head & m_mask];
+            std::ostream &stream = e.lvl >= level::error ? elog : log;
+
+            stream << '[' << e.where.file << ", " << e.where.function << ':' << e.where.line << "]: ";
+            e.print(stream, e.storage);
+            stream << '\n';
+
+            e.destroy(e.storage);
+            ++m_head;
+        }
+
+        if (const auto dropped = std::exchange(m_dropped, 0)) {
+            elog << "[logger]: " << dropped << " records dropped, the log ring is full.\n";
+        }
+        log.flush();
+        elog.flush();
+    }
+
+private:
+    template<typename Tuple, typename... Ts>
+    static void emplace(entry &e, Ts &&...ts) {
+        new (e.storage) Tuple(std::forward<Ts>(ts)...);
+        e.print = [] (std::ostream &stream, void *storage) {
+            std::apply([&stream] (const auto &...args) {
+                (stream << ... << args);
+            }, *static_cast<Tuple*>(storage));
+        };
+        e.destroy = [] (void *storage) {
+            static_cast<Tuple*>(storage)->~Tuple();
+        };
+    }
+};
+
+} // namespace logger
+} // namespace zpp
+
+#endif // __QUIC_FILEHOST_UTILS_LOG_RING_HH__
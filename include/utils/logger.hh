@@ -1,9 +1,22 @@
 #ifndef __QUIC_FILEHOST_UTILS_HH__
 #define __QUIC_FILEHOST_UTILS_HH__
 
+#include <utils/log_ring.hh>
+
+#include <atomic>       // std::atomic
 #include <concepts>     // std::same_as
+#include <cstddef>      // std::size_t
 #include <exception>    // std::terminate
 #include <iostream>     // std::ostream, std::cout, std::cerr
+#include <memory>       // std::unique_ptr
+
+/**
+ * Records below this level are compiled out: 0 trace, 1 debug, 2 info, 3 error.
+ * Nothing of them is left but the evaluation of their arguments.
+ */
+#if not defined(ZPP_LOG_LEVEL)
+#define ZPP_LOG_LEVEL 2
+#endif
 
 namespace zpp {
 namespace logger {
@@ -34,8 +47,40 @@ constexpr inline std::ostream &get_std_fail_stream() {
     return get_std_elog_stream();
 }
 
+inline std::atomic<level> runtime_level{level::info};
+
+/** The calling shard's ring, if it logs through one. */
+inline thread_local std::unique_ptr<ring> shard_ring{};
+
 } // namespace detail
 
+/** The lowest level compiled into the program. */
+inline constexpr level compiled_level = static_cast<level>(ZPP_LOG_LEVEL);
+
+/** @brief Sets the lowest level logged from now on, on every shard. Levels compiled out stay out. */
+inline void set_level(const level lvl) noexcept {
+    ::zpp::logger::detail::runtime_level.store(lvl, std::memory_order_relaxed);
+}
+
+inline bool enabled(const level lvl) noexcept {
+    return lvl >= compiled_level && lvl >= ::zpp::logger::detail::runtime_level.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Makes the records of the calling shard go through a ring of `capacity`
+ *        entries instead of being written out right away. `flush` writes them.
+ */
+inline void use_ring(const std::size_t capacity = ring::DEFAULT_CAPACITY) {
+    ::zpp::logger::detail::shard_ring = std::make_unique<ring>(capacity);
+}
+
+/** @brief Writes out the records queued by the calling shard. */
+inline void flush() {
+    if (auto &r = ::zpp::logger::detail::shard_ring) {
+        r->flush(::zpp::logger::detail::get_std_log_stream(), ::zpp::logger::detail::get_std_elog_stream());
+    }
+}
+
 /** Log a message. */
 template<typename... Ts>
 inline void log(Ts &&...ts) {
@@ -51,6 +96,7 @@ inline void elog(Ts &&...ts) {
 /** Log an error message and terminate the program. */
 template<typename... Ts>
 inline void fail(Ts &&...ts) {
+    ::zpp::logger::flush();
     ::zpp::logger::detail::raw_log(::zpp::logger::detail::get_std_fail_stream(), std::forward<Ts>(ts)..., '\n');
     std::terminate();
 }
@@ -62,6 +108,30 @@ inline void raw_log_location(Stream &stream, const auto &filename, const auto &f
     ::zpp::logger::detail::raw_log(stream, '[', filename, ", ", function_name, ':', line, "]: ");
 }
 
+template<level Level, typename... Ts>
+inline void raw_flog(const location &where, Ts &&...ts) {
+    if constexpr (Level >= compiled_level) {
+        if (!::zpp::logger::enabled(Level)) {
+            return;
+        }
+        if (auto &r = ::zpp::logger::detail::shard_ring) {
+            r->push(Level, where, std::forward<Ts>(ts)...);
+            return;
+        }
+
+        auto &stream = Level >= level::error ? get_std_elog_stream() : get_std_log_stream();
+        ::zpp::logger::detail::raw_log_location(stream, where.file, where.function, where.line);
+        ::zpp::logger::detail::raw_log(stream, std::forward<Ts>(ts)..., '\n');
+    }
+}
+
+template<typename... Ts>
+inline void raw_ffail(const location &where, Ts &&...ts) {
+    ::zpp::logger::flush();
+    ::zpp::logger::detail::raw_log_location(get_std_fail_stream(), where.file, where.function, where.line);
+    ::zpp::logger::fail(std::forward<Ts>(ts)...);
+}
+
 } // namespace detail
 } // namespace logger
 } // namespace zpp
@@ -74,39 +144,15 @@ namespace zpp {
 namespace logger {
 namespace detail {
 
-template<typename Stream>
-inline void log_location(Stream &stream, const std::source_location &srcloc) {
-    ::zpp::logger::detail::raw_log_location(stream, srcloc.file_name(), srcloc.function_name(), srcloc.line());
-}
-
-template<typename... Ts>
-inline void raw_flog(const std::source_location &srcloc, Ts &&...ts) {
-    ::zpp::logger::detail::log_location(::zpp::logger::detail::get_std_log_stream(), srcloc);
-    ::zpp::logger::log(std::forward<Ts>(ts)...);
-}
-
-template<typename... Ts>
-inline void raw_eflog(const std::source_location &srcloc, Ts &&...ts) {
-    ::zpp::logger::detail::log_location(::zpp::logger::detail::get_std_elog_stream(), srcloc);
-    ::zpp::logger::elog(std::forward<Ts>(ts)...);
-}
-
-template<typename... Ts>
-inline void raw_ffail(const std::source_location &srcloc, Ts &&...ts) {
-    ::zpp::logger::detail::log_location(::zpp::logger::detail::get_std_fail_stream(), srcloc);
-    ::zpp::logger::fail(std::forward<Ts>(ts)...);
+constexpr location location_of(const std::source_location &srcloc) {
+    return location{srcloc.file_name(), srcloc.function_name(), static_cast<unsigned>(srcloc.line())};
 }
 
 } // namespace detail
 } // namespace logger
 } // namespace zpp
 
-/** Log a message and the location of the logging. */
-#define  flog(...)  detail::raw_flog(std::source_location::current(), __VA_ARGS__)
-/** Log an error message and the location of the logging. */
-#define eflog(...) detail::raw_eflog(std::source_location::current(), __VA_ARGS__)
-/** Log an error message and the location of the logging. After that, terminate the program. */
-#define ffail(...) detail::raw_ffail(std::source_location::current(), __VA_ARGS__)
+#define ZPP_LOG_HERE ::zpp::logger::detail::location_of(std::source_location::current())
 
 #else
 
@@ -145,55 +191,26 @@ consteval const char *get_filepath(const char *const filepath) {
         : filepath;
 }
 
-template<typename... Ts>
-inline void raw_flog(const auto &filename, const auto &function, const auto &line, Ts &&...ts) {
-    ::zpp::logger::detail::raw_log_location(::zpp::logger::detail::get_std_log_stream(), filename, function, line);
-    ::zpp::logger::log(std::forward<Ts>(ts)...);
-}
-
-template<typename... Ts>
-inline void raw_eflog(const auto &filename, const auto &function, const auto &line, Ts &&...ts) {
-    ::zpp::logger::detail::raw_log_location(::zpp::logger::detail::get_std_elog_stream(), filename, function, line);
-    ::zpp::logger::elog(std::forward<Ts>(ts)...);
-}
-
-template<typename... Ts>
-inline void raw_ffail(const auto &filename, const auto &function, const auto &line, Ts &&...ts) {
-    ::zpp::logger::detail::raw_log_location(::zpp::logger::detail::get_std_fail_stream(), filename, function, line);
-    ::zpp::logger::fail(std::forward<Ts>(ts)...);
-}
-
 } // namespace detail
 } // namespace logger
 } // namespace zpp
 
-/** Log a message and the location of the logging. */
-#define flog(...)                                       \
-    detail::raw_flog(                                   \
-        ::zpp::logger::detail::get_filepath(__FILE__),  \
-        __func__,                                       \
-        __LINE__,                                       \
-        __VA_ARGS__                                     \
-    )
+#define ZPP_LOG_HERE                                                                \
+    ::zpp::logger::detail::location{                                                \
+        ::zpp::logger::detail::get_filepath(__FILE__), __func__, __LINE__           \
+    }
 
-/** Log an error message and the location of the logging. */
-#define eflog(...)                                      \
-    detail::raw_eflog(                                  \
-        ::zpp::logger::detail::get_filepath(__FILE__),  \
-        __func__,                                       \
-        __LINE__,                                       \
-        __VA_ARGS__                                     \
-    )
+#endif // if __cpp_lib_source_location >= 201907L
 
+/** Log a per-packet trace message and the location of the logging. */
+#define tflog(...) detail::raw_flog<::zpp::logger::level::trace>(ZPP_LOG_HERE, __VA_ARGS__)
+/** Log a debug message and the location of the logging. */
+#define dflog(...) detail::raw_flog<::zpp::logger::level::debug>(ZPP_LOG_HERE, __VA_ARGS__)
+/** Log a message and the location of the logging. */
+#define  flog(...) detail::raw_flog<::zpp::logger::level::info>(ZPP_LOG_HERE, __VA_ARGS__)
+/** Log an error message and the location of the logging. */
+#define eflog(...) detail::raw_flog<::zpp::logger::level::error>(ZPP_LOG_HERE, __VA_ARGS__)
 /** Log an error message and the location of the logging. After that, terminate the program. */
-#define ffail(...)                                      \
-    detail::raw_ffail(                                  \
-        ::zpp::logger::detail::get_filepath(__FILE__),  \
-        __func__,                                       \
-        __LINE__,                                       \
-        __VA_ARGS__                                     \
-    )
-
-#endif // if __cpp_lib_source_location >= 201907L
+#define ffail(...) detail::raw_ffail(ZPP_LOG_HERE, __VA_ARGS__)
 
 #endif // __QUIC_FILEHOST_UTILS_HH__
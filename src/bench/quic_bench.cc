@@ -0,0 +1,572 @@
+#include <lsquic/lsquic.h>
+
+#include <quic/detail/udp_socket.hh>
+
+#include <utils/logger.hh>
+
+#include <seastar/core/app-template.hh>
+#include <seastar/core/circular_buffer.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/net/api.hh>
+#include <seastar/net/inet_address.hh>
+
+#include <algorithm>  // std::min, std::max, std::nth_element
+#include <chrono>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>    // std::memcpy, std::memset
+#include <fstream>
+#include <iostream>
+#include <memory>     // std::unique_ptr
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>  // getrusage
+#include <unistd.h>        // sysconf
+
+/*
+ * A load generator for echo_server. It opens `connections` connections with
+ * `streams` streams each. Every stream uploads a request and is closed as soon
+ * as `response-bytes` bytes have come back, which counts as one request; a new
+ * stream then takes its place. Connections closed by the server are reopened,
+ * so handshakes keep happening for the whole run. The results are printed as
+ * a single JSON line.
+ */
+
+using namespace zpp;
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_options {
+    seastar::socket_address     server;
+    std::string                 sni;
+    unsigned                    connections;
+    unsigned                    streams;
+    std::size_t                 request_bytes;
+    std::size_t                 response_bytes;
+    std::chrono::milliseconds   duration;
+    std::chrono::milliseconds   drain_timeout;
+    std::optional<long>         server_pid;
+    std::string                 label;
+};
+
+/** Latency samples in microseconds. */
+class latency_samples {
+private:
+    std::vector<std::uint64_t> m_samples{};
+
+public:
+    void add(const bench_clock::duration elapsed) {
+        m_samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    std::size_t size() const noexcept {
+        return m_samples.size();
+    }
+
+    /** @param q In [0, 1]. */
+    std::uint64_t quantile(const double q) {
+        if (m_samples.empty()) {
+            return 0;
+        }
+        const auto idx = std::min(m_samples.size() - 1, static_cast<std::size_t>(q * m_samples.size()));
+        std::nth_element(m_samples.begin(), m_samples.begin() + idx, m_samples.end());
+        return m_samples[idx];
+    }
+
+    void to_json(std::ostream &out) {
+        out << "{\"count\":" << size()
+            << ",\"p50\":"   << quantile(0.5)
+            << ",\"p99\":"   << quantile(0.99)
+            << ",\"p999\":"  << quantile(0.999)
+            << ",\"max\":"   << quantile(1.0) << '}';
+    }
+};
+
+/** CPU time used by `pid` so far, or by this process without one. */
+std::optional<double> cpu_seconds(const std::optional<long> pid) {
+    if (!pid) {
+        rusage usage{};
+        ::getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    std::ifstream stat("/proc/" + std::to_string(*pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return std::nullopt;
+    }
+
+    // The command may contain spaces, but is the only field in parentheses.
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    // utime and stime are fields 14 and 15; the state is field 3.
+    for (int i = 3; i < 14 && fields >> field; ++i) {}
+    if (!(fields >> utime >> stime)) {
+        return std::nullopt;
+    }
+    return static_cast<double>(utime + stime) / ::sysconf(_SC_CLK_TCK);
+}
+
+class bench_client;
+
+struct connection_state {
+    bench_client       *client;
+    lsquic_conn_t      *connection;
+    bench_clock::time_point connected_at;
+};
+
+struct stream_state {
+    connection_state   *connection;
+    bench_clock::time_point opened_at;
+    std::size_t         sent        = 0;
+    std::size_t         received    = 0;
+};
+
+class bench_client {
+private:
+    static constexpr std::size_t IO_CHUNK = 0x4000;
+
+    bench_options                                       m_options;
+    seastar::net::udp_channel                           m_channel;
+    seastar::circular_buffer<quic::detail::outgoing_datagram> m_send_queue{};
+    seastar::future<>                                   m_sender = seastar::make_ready_future<>();
+    seastar::timer<>                                    m_timer{};
+    lsquic_engine_t                                    *m_engine = nullptr;
+    std::vector<char>                                   m_request_chunk = std::vector<char>(IO_CHUNK, 'B');
+    std::vector<unsigned char>                          m_read_chunk = std::vector<unsigned char>(IO_CHUNK);
+
+    unsigned                    m_live_connections  = 0;
+    bool                        m_stopping          = false;
+    bench_clock::time_point     m_started_at{};
+    bench_clock::time_point     m_stopped_at{};
+    std::uint64_t               m_bytes_received    = 0;
+    std::uint64_t               m_bytes_sent        = 0;
+    std::uint64_t               m_requests          = 0;
+    std::uint64_t               m_handshakes        = 0;
+    std::uint64_t               m_handshake_failures = 0;
+    latency_samples             m_request_latency{};
+    latency_samples             m_handshake_latency{};
+    std::optional<double>       m_server_cpu_start{};
+    std::optional<double>       m_client_cpu_start{};
+
+public:
+    explicit bench_client(bench_options options)
+    : m_options(std::move(options))
+    , m_channel(seastar::make_udp_channel()) {}
+
+    bench_client(const bench_client&) = delete;
+    bench_client &operator=(const bench_client&) = delete;
+
+    ~bench_client() {
+        if (m_engine) {
+            lsquic_engine_destroy(m_engine);
+        }
+    }
+
+    void init();
+    /** @brief Runs the benchmark and prints the results. */
+    seastar::future<> run();
+
+private:
+    static lsquic_conn_ctx_t   *on_new_connection(void *ctx, lsquic_conn_t *connection);
+    static void                 on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status status);
+    static void                 on_connection_closed(lsquic_conn_t *connection);
+    static lsquic_stream_ctx_t *on_new_stream(void *ctx, lsquic_stream_t *stream);
+    static void                 on_read(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx);
+    static void                 on_write(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx);
+    static void                 on_close(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx);
+    static int                  packets_out(void *ctx, const lsquic_out_spec *specs, unsigned int count);
+
+    void                connect();
+    void                process_connections();
+    seastar::future<>   receive();
+    seastar::future<>   flush_send_queue();
+    void                print_results();
+};
+
+void bench_client::init() {
+    if (lsquic_global_init(LSQUIC_GLOBAL_CLIENT) != 0) {
+        logger::ffail("Initialisation of lsquic has failed.");
+    }
+
+    static lsquic_stream_if callbacks = {
+        .on_new_conn    = on_new_connection,
+        .on_conn_closed = on_connection_closed,
+        .on_new_stream  = on_new_stream,
+        .on_read        = on_read,
+        .on_write       = on_write,
+        .on_close       = on_close,
+        .on_hsk_done    = on_handshake_done
+    };
+
+    lsquic_engine_settings settings{};
+    lsquic_engine_init_settings(&settings, 0);
+    settings.es_ql_bits = 0;
+
+    char errbuf[0x100];
+    if (lsquic_engine_check_settings(&settings, 0, errbuf, sizeof(errbuf)) != 0) {
+        logger::ffail("Invalid settings: ", errbuf);
+    }
+
+    lsquic_engine_api eapi{};
+    std::memset(&eapi, 0, sizeof(eapi));
+    eapi.ea_packets_out     =  packets_out;
+    eapi.ea_packets_out_ctx =  this;
+    eapi.ea_stream_if       = &callbacks;
+    eapi.ea_stream_if_ctx   =  this;
+    eapi.ea_settings        = &settings;
+    eapi.ea_alpn            =  "echo";
+
+    m_engine = lsquic_engine_new(0, &eapi);
+    if (!m_engine) {
+        logger::ffail("Creating an engine has failed.");
+    }
+
+    m_timer.set_callback([this] {
+        process_connections();
+    });
+}
+
+seastar::future<> bench_client::run() {
+    m_server_cpu_start = cpu_seconds(m_options.server_pid);
+    m_client_cpu_start = cpu_seconds(std::nullopt);
+    m_started_at = bench_clock::now();
+
+    for (unsigned i = 0; i < m_options.connections; ++i) {
+        connect();
+    }
+    process_connections();
+
+    // The receive loop ends with the channel, once the results are in.
+    (void) seastar::keep_doing([this] {
+        return receive();
+    }).handle_exception([] (std::exception_ptr) {});
+
+    return seastar::sleep(m_options.duration).then([this] {
+        m_stopping   = true;
+        m_stopped_at = bench_clock::now();
+        print_results();
+
+        lsquic_engine_close_conns(m_engine);
+        process_connections();
+
+        const auto deadline = bench_clock::now() + m_options.drain_timeout;
+        return seastar::do_until([this, deadline] {
+            return m_live_connections == 0 || bench_clock::now() >= deadline;
+        }, [] {
+            return seastar::sleep(std::chrono::milliseconds(10));
+        });
+    }).then([this] {
+        m_timer.cancel();
+        m_channel.shutdown_input();
+        return std::move(m_sender);
+    });
+}
+
+void bench_client::connect() {
+    const auto local = m_channel.local_address();
+    lsquic_conn_t *connection = lsquic_engine_connect(
+        m_engine,
+        N_LSQVER,
+        &local.as_posix_sockaddr(),
+        &m_options.server.as_posix_sockaddr(),
+        this,
+        nullptr,
+        m_options.sni.c_str(),
+        0,
+        nullptr, 0,
+        nullptr, 0
+    );
+    if (!connection) {
+        logger::eflog("Connecting to the server has failed.");
+    }
+}
+
+void bench_client::process_connections() {
+    lsquic_engine_process_conns(m_engine);
+
+    int diff;
+    if (!lsquic_engine_earliest_adv_tick(m_engine, &diff)) {
+        m_timer.cancel();
+        return;
+    }
+    const auto timeout = std::chrono::microseconds(diff <= 0 ? 0 : std::max(diff, LSQUIC_DF_CLOCK_GRANULARITY));
+    m_timer.rearm(seastar::timer<>::clock::now() + timeout);
+}
+
+seastar::future<> bench_client::receive() {
+    return m_channel.receive().then([this] (seastar::net::udp_datagram datagram) {
+        seastar::net::packet &packet = datagram.get_data();
+        packet.linearize();
+        const auto &fragment = *packet.fragment_array();
+
+        const auto local = m_channel.local_address();
+        const auto peer  = datagram.get_src();
+        lsquic_engine_packet_in(
+            m_engine,
+            reinterpret_cast<const unsigned char*>(fragment.base),
+            fragment.size,
+            &local.as_posix_sockaddr(),
+            &peer.as_posix_sockaddr(),
+            this,
+            0
+        );
+        process_connections();
+    });
+}
+
+seastar::future<> bench_client::flush_send_queue() {
+    return seastar::do_until([this] { return m_send_queue.empty(); }, [this] {
+        return m_channel.send(m_send_queue.front().destination, std::move(m_send_queue.front().packet))
+                .handle_exception([] (std::exception_ptr ex) {
+            logger::eflog("Sending a datagram has failed: ", ex);
+        }).finally([this] {
+            m_send_queue.pop_front();
+        });
+    });
+}
+
+int bench_client::packets_out(void *ctx, const lsquic_out_spec *specs, unsigned int count) {
+    auto *client = reinterpret_cast<bench_client*>(ctx);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        // lsquic reuses the memory once this returns, while the datagram may
+        // wait in the queue, so it gets a copy of its own.
+        std::size_t size = 0;
+        for (std::size_t j = 0; j < specs[i].iovlen; ++j) {
+            size += specs[i].iov[j].iov_len;
+        }
+        seastar::temporary_buffer<char> buffer(size);
+        char *dst = buffer.get_write();
+        for (std::size_t j = 0; j < specs[i].iovlen; ++j) {
+            std::memcpy(dst, specs[i].iov[j].iov_base, specs[i].iov[j].iov_len);
+            dst += specs[i].iov[j].iov_len;
+        }
+
+        client->m_send_queue.push_back(quic::detail::outgoing_datagram{
+            quic::detail::to_socket_address(specs[i].dest_sa),
+            seastar::net::packet(std::move(buffer))
+        });
+    }
+
+    // A finished sender has emptied the queue; a running one picks the new datagrams up.
+    if (count && client->m_sender.available()) {
+        client->m_sender = client->flush_send_queue();
+    }
+    return count;
+}
+
+lsquic_conn_ctx_t *bench_client::on_new_connection(void *ctx, lsquic_conn_t *connection) {
+    auto *client = reinterpret_cast<bench_client*>(ctx);
+    ++client->m_live_connections;
+    return reinterpret_cast<lsquic_conn_ctx_t*>(
+            new connection_state{client, connection, bench_clock::now()});
+}
+
+void bench_client::on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status status) {
+    auto *state  = reinterpret_cast<connection_state*>(lsquic_conn_get_ctx(connection));
+    auto *client = state->client;
+
+    if (status != LSQ_HSK_OK && status != LSQ_HSK_RESUMED_OK) {
+        ++client->m_handshake_failures;
+        return;
+    }
+
+    ++client->m_handshakes;
+    client->m_handshake_latency.add(bench_clock::now() - state->connected_at);
+    for (unsigned i = 0; i < client->m_options.streams; ++i) {
+        lsquic_conn_make_stream(connection);
+    }
+}
+
+void bench_client::on_connection_closed(lsquic_conn_t *connection) {
+    auto *state  = reinterpret_cast<connection_state*>(lsquic_conn_get_ctx(connection));
+    auto *client = state->client;
+
+    lsquic_conn_set_ctx(connection, nullptr);
+    delete state;
+
+    --client->m_live_connections;
+    if (!client->m_stopping) {
+        client->connect();
+    }
+}
+
+lsquic_stream_ctx_t *bench_client::on_new_stream([[maybe_unused]] void *ctx, lsquic_stream_t *stream) {
+    if (!stream) {
+        // The connection has gone away before the stream could be created.
+        return nullptr;
+    }
+
+    auto *connection = reinterpret_cast<connection_state*>(lsquic_conn_get_ctx(lsquic_stream_conn(stream)));
+    lsquic_stream_wantwrite(stream, 1);
+    return reinterpret_cast<lsquic_stream_ctx_t*>(new stream_state{connection, bench_clock::now()});
+}
+
+void bench_client::on_write(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx) {
+    auto *state  = reinterpret_cast<stream_state*>(ctx);
+    auto *client = state->connection->client;
+
+    const std::size_t left = client->m_options.request_bytes - state->sent;
+    const auto written = lsquic_stream_write(stream, client->m_request_chunk.data(),
+            std::min(left, client->m_request_chunk.size()));
+    if (written < 0) {
+        lsquic_stream_close(stream);
+        return;
+    }
+
+    state->sent += written;
+    client->m_bytes_sent += written;
+    if (state->sent == client->m_options.request_bytes) {
+        lsquic_stream_shutdown(stream, 1);
+        lsquic_stream_wantwrite(stream, 0);
+        lsquic_stream_wantread(stream, 1);
+    }
+}
+
+void bench_client::on_read(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx) {
+    auto *state  = reinterpret_cast<stream_state*>(ctx);
+    auto *client = state->connection->client;
+
+    const auto count = lsquic_stream_read(stream, client->m_read_chunk.data(), client->m_read_chunk.size());
+    if (count < 0 && errno == EWOULDBLOCK) {
+        return;
+    }
+    if (count > 0) {
+        state->received += count;
+        if (!client->m_stopping) {
+            client->m_bytes_received += count;
+        }
+    }
+
+    if (count <= 0 || state->received >= client->m_options.response_bytes) {
+        if (count > 0 && !client->m_stopping) {
+            ++client->m_requests;
+            client->m_request_latency.add(bench_clock::now() - state->opened_at);
+        }
+        lsquic_stream_close(stream);
+    }
+}
+
+void bench_client::on_close(lsquic_stream_t *stream, lsquic_stream_ctx_t *ctx) {
+    auto *state = reinterpret_cast<stream_state*>(ctx);
+    if (!state) {
+        return;
+    }
+
+    const bool replace = !state->connection->client->m_stopping;
+    delete state;
+    if (replace) {
+        lsquic_conn_make_stream(lsquic_stream_conn(stream));
+    }
+}
+
+void bench_client::print_results() {
+    const double seconds = std::chrono::duration<double>(m_stopped_at - m_started_at).count();
+    const auto server_cpu_end = cpu_seconds(m_options.server_pid);
+    const auto client_cpu_end = cpu_seconds(std::nullopt);
+    const double gigabytes = m_bytes_received / 1e9;
+
+    std::ostringstream out;
+    out << "{\"label\":\""                      << m_options.label
+        << "\",\"connections\":"                << m_options.connections
+        << ",\"streams_per_connection\":"       << m_options.streams
+        << ",\"request_bytes\":"                << m_options.request_bytes
+        << ",\"response_bytes\":"               << m_options.response_bytes
+        << ",\"duration_s\":"                   << seconds
+        << ",\"bytes_received\":"               << m_bytes_received
+        << ",\"bytes_sent\":"                   << m_bytes_sent
+        << ",\"goodput_bytes_per_s\":"          << m_bytes_received / seconds
+        << ",\"requests\":"                     << m_requests
+        << ",\"requests_per_s\":"               << m_requests / seconds
+        << ",\"handshakes\":"                   << m_handshakes
+        << ",\"handshake_failures\":"           << m_handshake_failures
+        << ",\"handshakes_per_s\":"             << m_handshakes / seconds
+        << ",\"request_latency_us\":";
+    m_request_latency.to_json(out);
+    out << ",\"handshake_latency_us\":";
+    m_handshake_latency.to_json(out);
+
+    if (m_server_cpu_start && server_cpu_end) {
+        const double cpu = *server_cpu_end - *m_server_cpu_start;
+        out << ",\"server_cpu_s\":" << cpu;
+        if (gigabytes > 0) {
+            out << ",\"server_cpu_s_per_gb\":" << cpu / gigabytes;
+        }
+    }
+    if (m_client_cpu_start && client_cpu_end) {
+        out << ",\"client_cpu_s\":" << *client_cpu_end - *m_client_cpu_start;
+    }
+    out << "}\n";
+
+    std::cout << out.str() << std::flush;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    seastar::app_template app;
+
+    namespace po = boost::program_options;
+    app.add_options()("server", po::value<std::string>()->default_value("127.0.0.1"), "address of the echo_server");
+    app.add_options()("port", po::value<std::uint16_t>()->required(), "port of the echo_server");
+    app.add_options()("sni", po::value<std::string>()->default_value("localhost"), "server name sent in the handshake");
+    app.add_options()("connections", po::value<unsigned>()->default_value(8), "concurrent connections");
+    app.add_options()("streams", po::value<unsigned>()->default_value(4), "concurrent streams per connection");
+    app.add_options()("request-bytes", po::value<std::size_t>()->default_value(1024), "bytes uploaded on every stream");
+    app.add_options()("response-bytes", po::value<std::size_t>()->default_value(0x10000),
+            "bytes read from every stream before it counts as a finished request");
+    app.add_options()("duration-s", po::value<unsigned>()->default_value(10), "length of the measurement");
+    app.add_options()("drain-timeout-ms", po::value<unsigned>()->default_value(1000),
+            "time given to the connections to close after the measurement");
+    app.add_options()("server-pid", po::value<long>(), "pid of the echo_server, to measure its CPU time per GB");
+    app.add_options()("label", po::value<std::string>()->default_value(""),
+            "copied into the results, e.g. the commit being measured");
+
+    try {
+        app.run(argc, argv, [&] () {
+            decltype(auto) config = app.configuration();
+            if (seastar::smp::count != 1) {
+                logger::ffail("quic_bench runs on a single shard; pass -c1.");
+            }
+
+            bench_options options{
+                .server         = seastar::socket_address(seastar::ipv4_addr(
+                        config["server"].as<std::string>(), config["port"].as<std::uint16_t>())),
+                .sni            = config["sni"].as<std::string>(),
+                .connections    = std::max(1u, config["connections"].as<unsigned>()),
+                .streams        = std::max(1u, config["streams"].as<unsigned>()),
+                .request_bytes  = config["request-bytes"].as<std::size_t>(),
+                .response_bytes = std::max<std::size_t>(1, config["response-bytes"].as<std::size_t>()),
+                .duration       = std::chrono::seconds(config["duration-s"].as<unsigned>()),
+                .drain_timeout  = std::chrono::milliseconds(config["drain-timeout-ms"].as<unsigned>()),
+                .server_pid     = std::nullopt,
+                .label          = config["label"].as<std::string>()
+            };
+            if (config.count("server-pid")) {
+                options.server_pid = config["server-pid"].as<long>();
+            }
+
+            auto client = std::make_unique<bench_client>(std::move(options));
+            client->init();
+            auto done = client->run();
+            return done.finally([client = std::move(client)] {});
+        });
+    } catch (...) {
+        logger::ffail("Couldn't start the benchmark: ", std::current_exception());
+    }
+    return 0;
+}
@@ -1,44 +1,492 @@
 #include <quic/common.hh>
 #include <quic/quic_stream.hh>
+#include <quic/remote_quic_stream.hh>
 #include <quic/server.hh>
+#include <quic/detail/handoff.hh>
+#include <quic/detail/shard_routing.hh>
+#include <quic/ssl/certificate_store.hh>
+#include <quic/ssl/ssl_handler.hh>
 
 #include <utils/logger.hh>
 
 #include <seastar/core/app-template.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/lowres_clock.hh>
+#include <seastar/core/prometheus.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/when_all.hh>
+#include <seastar/http/httpd.hh>
 
+#include <algorithm>  // std::max, std::find
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>  // std::memset
+#include <csignal>  // SIGHUP
 #include <exception>
+#include <optional>
+#include <string>
+#include <vector>
 
 using namespace zpp;
 using namespace quic;
 
-seastar::future<> submit_to_cores(std::uint16_t port, detail::base_quic_stream<quic_stream_value_t> *stream) {
+namespace {
+
+constexpr std::size_t FEED_CHUNK_SIZE   = 0x1000;
+/** How long a shard waits before listening for a successor again after a failed handoff. */
+constexpr std::chrono::seconds HANDOFF_RETRY_DELAY{1};
+
+/** The server of the current shard, while it's serving. */
+thread_local server *local_server = nullptr;
+
+/** A chunk of synthetic data, shared by every write instead of being copied. */
+seastar::temporary_buffer<quic_stream_value_t> make_feed_chunk() {
+    seastar::temporary_buffer<quic_stream_value_t> chunk(FEED_CHUNK_SIZE);
+    std::memset(chunk.get_write(), 'A', chunk.size());
+    return chunk;
+}
+
+/** Keeps writing synthetic data to `stream` until the peer closes it. */
+seastar::future<> feed_stream(quic_stream<quic_stream_value_t> stream) {
+    return seastar::do_with(std::move(stream), make_feed_chunk(),
+            [] (quic_stream<quic_stream_value_t> &stream, seastar::temporary_buffer<quic_stream_value_t> &chunk) {
+        return seastar::keep_doing([&stream, &chunk] {
+            return stream.write(chunk.share());
+        });
+    }).handle_exception_type([] (const stream_closed_error&) {});
+}
+
+/** Same as `feed_stream`, but driven from another shard than the one serving the stream. */
+seastar::future<> feed_remote_stream(remote_quic_stream<quic_stream_value_t> stream) {
+    return seastar::do_with(std::move(stream), make_feed_chunk(),
+            [] (remote_quic_stream<quic_stream_value_t> &stream, seastar::temporary_buffer<quic_stream_value_t> &chunk) {
+        return seastar::keep_doing([&stream, &chunk] {
+            // Shares can't cross shards: the reference count isn't atomic.
+            return stream.write(chunk.clone());
+        });
+    }).handle_exception_type([] (const stream_closed_error&) {});
+}
+
+/** Reads and discards whatever the peer uploads on `stream`, until it finishes. */
+seastar::future<> drain_stream(quic_stream<quic_stream_value_t> stream) {
+    return seastar::do_with(std::move(stream), [] (quic_stream<quic_stream_value_t> &stream) {
+        return seastar::repeat([&stream] {
+            return stream.read().then([] (seastar::temporary_buffer<quic_stream_value_t> data) {
+                return data.empty() ? seastar::stop_iteration::yes : seastar::stop_iteration::no;
+            });
+        });
+    }).handle_exception_type([] (const stream_closed_error&) {});
+}
+
+/**
+ * Accepts the streams of `srv` and feeds them from `feeder_shard`, or from
+ * the serving shard if it's not set, until the server is stopped.
+ */
+seastar::future<> accept_streams(server &srv, std::optional<unsigned> feeder_shard) {
+    return seastar::keep_doing([&srv, feeder_shard] {
+        return srv.accept().then([feeder_shard] (quic_stream<quic_stream_value_t> stream) {
+            auto on_error = [] (std::exception_ptr ex) {
+                logger::eflog("Serving a stream has failed: ", ex);
+            };
+
+            (void) drain_stream(stream).handle_exception(on_error);
+
+            if (!feeder_shard || *feeder_shard == seastar::this_shard_id()) {
+                (void) feed_stream(std::move(stream)).handle_exception(on_error);
+                return;
+            }
+
+            (void) seastar::smp::submit_to(*feeder_shard,
+                    [remote = remote_quic_stream<quic_stream_value_t>(std::move(stream)), on_error] () mutable {
+                (void) feed_remote_stream(std::move(remote)).handle_exception(on_error);
+            }).handle_exception(on_error);
+        });
+    }).handle_exception_type([] (const server_stopped_error&) {});
+}
+
+} // anonymous namespace
+
+struct stream_limits {
+    std::size_t max_buffer;
+    std::size_t low_watermark;
+    std::size_t high_watermark;
+};
+
+struct send_limits {
+    std::size_t queue_size;
+};
+
+struct handoff_options {
+    /** The Unix socket a successor takes the UDP sockets over through; empty disables hot restarts. */
+    std::string                 path;
+    /** The sockets taken over from a predecessor, one per shard. */
+    std::vector<int>            sockets;
+    /** The connection ID generation of the predecessor, if there is one. */
+    std::optional<std::uint8_t> predecessor;
+};
+
+struct shutdown_options {
+    /** How long streams may keep going once the server is asked to stop. */
+    std::chrono::milliseconds   drain_timeout;
+};
+
+struct admission_options {
+    std::size_t                 handshake_threshold;
+    std::chrono::seconds        validated_ttl;
+};
+
+struct stats_options {
+    std::chrono::milliseconds   period;
+    /** Prefix of the per-shard JSON-lines files; empty disables them. */
+    std::string                 dump_prefix;
+};
+
+struct log_options {
+    /** Records each shard queues before writing them out; 0 writes them right away. */
+    std::size_t                 ring_size;
+    std::chrono::milliseconds   flush_period;
+};
+
+seastar::future<> submit_to_cores(std::uint16_t port, udp_options udp, receive_batching batching,
+        stream_limits limits, send_limits sends, shutdown_options shutdown, handoff_options handoff,
+        admission_options admission, stats_options stats, log_options logs, server_config engine,
+        std::optional<unsigned> feeder_shard) {
+    // Seastar runs the exit tasks of shard 0 before those of the others, so
+    // a single task stops every shard at once. `local_server` is cleared as
+    // soon as a server is gone, and a shard that has failed is skipped.
+    seastar::engine().at_exit([shutdown] {
+        return seastar::smp::invoke_on_all([shutdown] {
+            return local_server ? local_server->stop(shutdown.drain_timeout) : seastar::make_ready_future<>();
+        });
+    });
+
     return seastar::parallel_for_each(boost::irange<unsigned>(0, seastar::smp::count),
-            [port, stream] (unsigned core) {
-        return seastar::smp::submit_to(core, [port, stream] () {
-            server srv(port);
-            return seastar::do_with(std::move(srv), [stream](server &srv) {
-                srv.init_lsquic(stream);
-                return srv.service_loop(stream->get_reversed_wrapper());
+            [port, udp, batching, limits, sends, handoff, admission, stats, logs, engine, feeder_shard] (unsigned core) {
+        return seastar::smp::submit_to(core,
+                [port, udp, batching, limits, sends, handoff, admission, stats, logs, engine, feeder_shard] () {
+            if (logs.ring_size) {
+                logger::use_ring(logs.ring_size);
+            }
+            udp_options shard_udp = udp;
+            if (!handoff.sockets.empty()) {
+                shard_udp.socket_fd = handoff.sockets[seastar::this_shard_id()];
+            }
+            server srv(port, shard_udp);
+            srv.set_engine_config(engine);
+            srv.set_receive_batching(batching);
+            srv.set_send_queue_size(sends.queue_size);
+            srv.set_max_stream_buffer(limits.max_buffer);
+            srv.set_stream_watermarks(limits.low_watermark, limits.high_watermark);
+            srv.set_handshake_admission(admission.handshake_threshold, admission.validated_ttl);
+            srv.set_stats_period(stats.period);
+            if (!stats.dump_prefix.empty()) {
+                srv.dump_connection_stats(stats.dump_prefix + '.' + std::to_string(seastar::this_shard_id()));
+            }
+            return seastar::do_with(std::move(srv), seastar::timer<seastar::lowres_clock>{},
+                    [feeder_shard, logs, handoff] (server &srv, seastar::timer<seastar::lowres_clock> &log_flusher) {
+                if (logs.ring_size) {
+                    log_flusher.set_callback([] {
+                        logger::flush();
+                    });
+                    log_flusher.arm_periodic(logs.flush_period);
+                }
+                srv.init_lsquic();
+                if (!handoff.path.empty()) {
+                    srv.accept_relayed(handoff.path);
+                    if (handoff.predecessor) {
+                        srv.relay_to_predecessor(handoff.path, *handoff.predecessor);
+                    }
+                }
+                local_server = &srv;
+                // Both loops end once `stop` has.
+                return seastar::when_all_succeed(srv.service_loop(), accept_streams(srv, feeder_shard)).discard_result()
+                        .finally([] {
+                    local_server = nullptr;
+                });
+            });
+        });
+    });
+}
+
+/** Collects the socket of every shard, -1 for the shards not serving yet. */
+seastar::future<std::vector<int>> collect_sockets() {
+    return seastar::do_with(std::vector<int>(seastar::smp::count, -1), [] (std::vector<int> &sockets) {
+        return seastar::parallel_for_each(boost::irange<unsigned>(0, seastar::smp::count), [&sockets] (unsigned core) {
+            return seastar::smp::submit_to(core, [] {
+                return local_server ? local_server->socket_fd() : -1;
+            }).then([&sockets, core] (int fd) {
+                sockets[core] = fd;
             });
+        }).then([&sockets] {
+            return std::move(sockets);
+        });
+    });
+}
+
+/**
+ * Waits for a process started with --take-over, hands it the socket of every
+ * shard and exits, draining the connections left on the way. A failed
+ * handoff leaves this process serving and waiting for another successor.
+ */
+seastar::future<> hand_over_to_successor(std::string path) {
+    return seastar::repeat([path = std::move(path)] {
+        return detail::wait_for_successor(path).then([] (detail::successor next) {
+            return seastar::do_with(std::move(next), [] (detail::successor &next) {
+                return collect_sockets().then([&next] (std::vector<int> sockets) {
+                    if (std::find(sockets.begin(), sockets.end(), -1) != sockets.end()) {
+                        throw detail::handoff_error("Not every shard is serving yet.");
+                    }
+                    return next.hand_over(detail::cid_generation(), sockets);
+                });
+            });
+        }).then([] {
+            logger::flog("Handed the sockets over, draining the connections left.");
+            return seastar::smp::invoke_on_all([] {
+                if (local_server) {
+                    local_server->hand_over_input();
+                }
+            });
+        }).then([] {
+            seastar::engine().exit(0);
+            return seastar::stop_iteration::yes;
+        }).handle_exception([] (std::exception_ptr ex) {
+            logger::eflog("Handing the sockets over has failed: ", ex);
+            return seastar::sleep(HANDOFF_RETRY_DELAY).then([] {
+                return seastar::stop_iteration::no;
+            });
+        });
+    });
+}
+
+/** Reloads the certificates on SIGHUP; connections keep the ones they've started with. */
+void reload_certificates_on_sighup(std::string directory, std::string default_name) {
+    seastar::engine().handle_signal(SIGHUP, [directory = std::move(directory), default_name = std::move(default_name)] {
+        (void) ssl::install_certificates(directory, default_name).handle_exception([] (std::exception_ptr ex) {
+            logger::eflog("Reloading the certificates has failed, keeping the old ones: ", ex);
+        });
+    });
+}
+
+/** Serves the metrics of every shard in the Prometheus format on `port`. */
+seastar::future<> start_prometheus(seastar::httpd::http_server_control &http, std::uint16_t port) {
+    return http.start("prometheus").then([&http] {
+        return seastar::prometheus::start(http, seastar::prometheus::config{});
+    }).then([&http, port] {
+        return http.listen(seastar::socket_address(seastar::ipv4_addr(port)));
+    }).then([&http, port] {
+        logger::flog("Serving metrics on port ", port, '.');
+        seastar::engine().at_exit([&http] {
+            return http.stop();
         });
     });
 }
 
 int main(int argc, char **argv) {
     seastar::app_template app;
+    seastar::httpd::http_server_control prometheus_server;
 
     namespace po = boost::program_options;
     app.add_options()("port", po::value<std::uint16_t>()->required(), "listen port");
+    app.add_options()("prometheus-port", po::value<std::uint16_t>()->default_value(9180),
+            "port serving the metrics in the Prometheus format (0 disables it)");
+    app.add_options()("quic-profile", po::value<std::string>()->default_value("default"),
+            "engine settings to start from: default, bulk-throughput or low-latency");
+    app.add_options()("quic-config", po::value<std::string>(),
+            "file of key = value engine settings, applied over --quic-profile");
+    app.add_options()("quic-option", po::value<std::vector<std::string>>()->composing(),
+            "a key=value engine setting, applied over --quic-config; may be repeated");
+    app.add_options()("cert-dir", po::value<std::string>()->default_value(PROJECT_ROOT_PATH "/ssl"),
+            "directory of <name>-cert.pem and <name>-key.pem pairs, picked by SNI and reloaded on SIGHUP");
+    app.add_options()("default-cert", po::value<std::string>()->default_value("mycert"),
+            "<name> of the pair served to clients asking for no known name (empty picks the first one)");
+    app.add_options()("tls-tickets", po::value<bool>()->default_value(true),
+            "issue TLS session tickets, letting clients resume sessions");
+    app.add_options()("ticket-lifetime-s", po::value<std::uint32_t>()->default_value(ssl::session_options{}.ticket_lifetime.count()),
+            "how long a session ticket may be used, in seconds");
+    app.add_options()("ticket-key-rotation-s", po::value<std::uint32_t>()->default_value(ssl::session_options{}.key_rotation.count()),
+            "how often the ticket key shared by all shards is replaced, in seconds");
+    app.add_options()("early-data", po::value<std::string>()->default_value("single-use"),
+            "0-RTT policy: off, single-use (each ticket resumes once, against replays) or replayable");
+    app.add_options()("udp-backend", po::value<std::string>()->default_value("channel"),
+            "how datagrams are sent and received: channel (seastar's udp_channel) or mmsg (sendmmsg/recvmmsg and UDP GSO/GRO)");
+    app.add_options()("udp-gso", po::value<bool>()->default_value(true),
+            "merge datagrams to the same peer into UDP GSO sends (mmsg backend only)");
+    app.add_options()("udp-gro", po::value<bool>()->default_value(true),
+            "receive datagrams coalesced by UDP GRO (mmsg backend only)");
+    app.add_options()("rx-batch", po::value<std::size_t>()->default_value(receive_batching{}.max_datagrams),
+            "maximum number of datagrams fed to the engine between two ticks (1 disables batching)");
+    app.add_options()("rx-batch-budget-us", po::value<std::uint32_t>()->default_value(receive_batching{}.time_budget.count()),
+            "time budget of a receive batch in microseconds");
+    app.add_options()("stream-buffer", po::value<std::size_t>()->default_value(
+                detail::one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_MAX_CAPACITY),
+            "maximum number of bytes buffered in each direction of a stream");
+    app.add_options()("stream-high-watermark", po::value<std::size_t>()->default_value(
+                detail::one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_HIGH_WATERMARK),
+            "buffered bytes at which writers to a stream are paused");
+    app.add_options()("stream-low-watermark", po::value<std::size_t>()->default_value(
+                detail::one_directionial_quic_stream<quic_stream_value_t>::DEFAULT_LOW_WATERMARK),
+            "buffered bytes at which paused writers to a stream are resumed");
+    app.add_options()("send-queue", po::value<std::size_t>()->default_value(server::DEFAULT_SEND_QUEUE_SIZE),
+            "maximum number of datagrams queued for sending on each shard before the engine is told to back off");
+    app.add_options()("handoff-socket", po::value<std::string>(),
+            "Unix socket through which a process started with --take-over takes the UDP sockets over (mmsg backend only)");
+    app.add_options()("take-over", po::bool_switch(),
+            "take the UDP sockets over from the process listening on --handoff-socket, relaying it the datagrams of its connections until it has drained");
+    app.add_options()("drain-timeout-ms", po::value<std::uint32_t>()->default_value(server::DEFAULT_DRAIN_TIMEOUT.count()),
+            "how long open streams may keep going on shutdown before their connections are closed, in milliseconds");
+    app.add_options()("handshake-threshold", po::value<std::size_t>()->default_value(0),
+            "handshakes in flight on a shard above which Initials are only accepted from validated addresses (0 accepts all)");
+    app.add_options()("validated-ttl-s", po::value<std::uint32_t>()->default_value(server::DEFAULT_VALIDATED_TTL.count()),
+            "how long an address stays validated after completing a handshake, in seconds");
+    app.add_options()("conn-stats-ms", po::value<std::uint32_t>()->default_value(server::DEFAULT_STATS_PERIOD.count()),
+            "how often the transport state of every connection is sampled, in milliseconds (0 samples closed connections only)");
+    app.add_options()("conn-stats-dump", po::value<std::string>(),
+            "append the transport state of every closed connection as JSON lines to <path>.<shard>");
+    app.add_options()("log-level", po::value<std::string>()->default_value("info"),
+            "lowest level logged: trace, debug, info or error (levels below the build's ZPP_LOG_LEVEL are compiled out)");
+    app.add_options()("log-ring", po::value<std::size_t>()->default_value(logger::ring::DEFAULT_CAPACITY),
+            "records each shard queues in memory and writes out in the background (0 writes every record right away)");
+    app.add_options()("log-flush-ms", po::value<std::uint32_t>()->default_value(100),
+            "how often each shard writes out its queued records, in milliseconds");
+    app.add_options()("feeder-shard", po::value<unsigned>(),
+            "shard producing the data of every stream (by default each stream is fed by the shard serving it)");
 
     try {
-        detail::base_quic_stream<quic_stream_value_t> *stream = new detail::base_quic_stream<quic_stream_value_t>{};
-        decltype(auto) s = stream->get_wrapper();
         app.run(argc, argv, [&] () {
             decltype(auto) config = app.configuration();
             std::uint16_t port = config["port"].as<std::uint16_t>();
-            return submit_to_cores(port, stream);
+            udp_options udp{
+                .gso            = config["udp-gso"].as<bool>(),
+                .gro            = config["udp-gro"].as<bool>()
+            };
+            if (const auto &backend = config["udp-backend"].as<std::string>(); backend == "mmsg") {
+                udp.backend = udp_backend::mmsg;
+            } else if (backend != "channel") {
+                logger::ffail("Unknown --udp-backend: ", backend, '.');
+            }
+            receive_batching batching{
+                .max_datagrams  = std::max<std::size_t>(1, config["rx-batch"].as<std::size_t>()),
+                .time_budget    = std::chrono::microseconds(config["rx-batch-budget-us"].as<std::uint32_t>())
+            };
+            if (const auto &lvl = config["log-level"].as<std::string>(); lvl == "trace") {
+                logger::set_level(logger::level::trace);
+            } else if (lvl == "debug") {
+                logger::set_level(logger::level::debug);
+            } else if (lvl == "info") {
+                logger::set_level(logger::level::info);
+            } else if (lvl == "error") {
+                logger::set_level(logger::level::error);
+            } else {
+                logger::ffail("Unknown --log-level: ", lvl, '.');
+            }
+            ssl::session_options sessions{
+                .tickets            = config["tls-tickets"].as<bool>(),
+                .ticket_lifetime    = std::chrono::seconds(config["ticket-lifetime-s"].as<std::uint32_t>()),
+                .key_rotation       = std::chrono::seconds(std::max<std::uint32_t>(1, config["ticket-key-rotation-s"].as<std::uint32_t>()))
+            };
+            if (const auto &policy = config["early-data"].as<std::string>(); policy == "off") {
+                sessions.early_data = ssl::early_data_policy::disabled;
+            } else if (policy == "replayable") {
+                sessions.early_data = ssl::early_data_policy::replayable;
+            } else if (policy != "single-use") {
+                logger::ffail("Unknown --early-data: ", policy, '.');
+            }
+            // Before any shard loads its certificate.
+            ssl::configure_sessions(sessions);
+
+            server_config engine{};
+            try {
+                engine = server_config::profile(config["quic-profile"].as<std::string>());
+                if (config.count("quic-config")) {
+                    engine.apply_file(config["quic-config"].as<std::string>());
+                }
+                if (config.count("quic-option")) {
+                    for (const auto &option : config["quic-option"].as<std::vector<std::string>>()) {
+                        engine.apply(option);
+                    }
+                }
+            } catch (const config_error &e) {
+                logger::ffail("Invalid engine settings: ", e.what());
+            }
+            if (const auto error = engine.check()) {
+                logger::ffail("Invalid engine settings: ", *error);
+            }
+            handoff_options handoff{};
+            if (config.count("handoff-socket")) {
+                handoff.path = config["handoff-socket"].as<std::string>();
+                if (udp.backend != udp_backend::mmsg) {
+                    logger::ffail("--handoff-socket needs --udp-backend mmsg.");
+                }
+            }
+            if (config["take-over"].as<bool>()) {
+                if (handoff.path.empty()) {
+                    logger::ffail("--take-over needs --handoff-socket.");
+                }
+                try {
+                    detail::takeover takeover = detail::take_over(handoff.path, seastar::smp::count);
+                    handoff.sockets     = std::move(takeover.sockets);
+                    handoff.predecessor = takeover.generation;
+                    // Before any shard generates a connection ID.
+                    detail::set_cid_generation(takeover.generation ^ 1);
+                } catch (const detail::handoff_error &e) {
+                    logger::ffail("Taking over from ", handoff.path, " has failed: ", e.what());
+                }
+                logger::flog("Took ", handoff.sockets.size(), " sockets over from ", handoff.path, '.');
+            }
+            const shutdown_options shutdown{
+                .drain_timeout  = std::chrono::milliseconds(config["drain-timeout-ms"].as<std::uint32_t>())
+            };
+            const admission_options admission{
+                .handshake_threshold    = config["handshake-threshold"].as<std::size_t>(),
+                .validated_ttl          = std::chrono::seconds(config["validated-ttl-s"].as<std::uint32_t>())
+            };
+            stats_options stats{
+                .period         = std::chrono::milliseconds(config["conn-stats-ms"].as<std::uint32_t>())
+            };
+            if (config.count("conn-stats-dump")) {
+                stats.dump_prefix = config["conn-stats-dump"].as<std::string>();
+            }
+            const log_options logs{
+                .ring_size      = config["log-ring"].as<std::size_t>(),
+                .flush_period   = std::chrono::milliseconds(std::max<std::uint32_t>(1, config["log-flush-ms"].as<std::uint32_t>()))
+            };
+            std::optional<unsigned> feeder_shard{};
+            if (config.count("feeder-shard")) {
+                feeder_shard = config["feeder-shard"].as<unsigned>();
+                if (*feeder_shard >= seastar::smp::count) {
+                    logger::ffail("--feeder-shard has to be less than the number of shards (", seastar::smp::count, ").");
+                }
+            }
+            const stream_limits limits{
+                .max_buffer     = config["stream-buffer"].as<std::size_t>(),
+                .low_watermark  = config["stream-low-watermark"].as<std::size_t>(),
+                .high_watermark = config["stream-high-watermark"].as<std::size_t>()
+            };
+            if (limits.low_watermark > limits.high_watermark) {
+                logger::ffail("--stream-low-watermark can't exceed --stream-high-watermark.");
+            }
+            const send_limits sends{
+                .queue_size     = std::max<std::size_t>(1, config["send-queue"].as<std::size_t>())
+            };
+            const std::uint16_t prometheus_port = config["prometheus-port"].as<std::uint16_t>();
+            auto metrics = prometheus_port
+                    ? start_prometheus(prometheus_server, prometheus_port)
+                    : seastar::make_ready_future<>();
+            const std::string cert_dir     = config["cert-dir"].as<std::string>();
+            const std::string default_cert = config["default-cert"].as<std::string>();
+            return metrics.then([cert_dir, default_cert] {
+                return ssl::install_certificates(cert_dir, default_cert);
+            }).then([=] {
+                reload_certificates_on_sighup(cert_dir, default_cert);
+                if (!handoff.path.empty()) {
+                    (void) hand_over_to_successor(handoff.path);
+                }
+                return submit_to_cores(port, udp, batching, limits, sends, shutdown, handoff, admission, stats,
+                        logs, engine, feeder_shard);
+            });
         });
     } catch (...) {
         logger::ffail("Couldn't start the application: ", std::current_exception());
@@ -0,0 +1,119 @@
+#include <quic/detail/admission_control.hh>
+
+#include <netinet/in.h>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+namespace {
+
+constexpr std::uint32_t QUIC_V2 = 0x6b3343cf;
+
+/** The address without the port, which NATs are free to change. */
+std::string address_key(const seastar::socket_address &address) {
+    const sockaddr &sa = address.as_posix_sockaddr();
+    if (sa.sa_family == AF_INET6) {
+        const auto &in6 = reinterpret_cast<const sockaddr_in6&>(sa);
+        return std::string(reinterpret_cast<const char*>(&in6.sin6_addr), sizeof(in6.sin6_addr));
+    }
+    const auto &in = reinterpret_cast<const sockaddr_in&>(sa);
+    return std::string(reinterpret_cast<const char*>(&in.sin_addr), sizeof(in.sin_addr));
+}
+
+/** The address together with the port, which tell the handshakes in flight apart. */
+std::string peer_key(const seastar::socket_address &address) {
+    const sockaddr &sa = address.as_posix_sockaddr();
+    std::string key = address_key(address);
+    const in_port_t port = sa.sa_family == AF_INET6
+            ? reinterpret_cast<const sockaddr_in6&>(sa).sin6_port
+            : reinterpret_cast<const sockaddr_in&>(sa).sin_port;
+    key.append(reinterpret_cast<const char*>(&port), sizeof(port));
+    return key;
+}
+
+} // anonymous namespace
+
+bool admission_control::admit(const unsigned char *data, const std::size_t size, const seastar::socket_address &src) {
+    if (!m_threshold) {
+        return true;
+    }
+
+    // Only long-header Initial packets start handshakes.
+    if (size < 6 || (data[0] & 0xc0) != 0xc0) {
+        return true;
+    }
+    const std::uint32_t version = (std::uint32_t{data[1]} << 24) | (std::uint32_t{data[2]} << 16)
+            | (std::uint32_t{data[3]} << 8) | std::uint32_t{data[4]};
+    const unsigned type = (data[0] >> 4) & 0x3;
+    if (version == 0 || type != (version == QUIC_V2 ? 1u : 0u)) {
+        return true;
+    }
+
+    const auto now = clock::now();
+    expire(now);
+
+    std::string key = peer_key(src);
+    if (m_pending.contains(key)) {
+        // A retransmission, or an Initial acknowledging the server's, of a
+        // handshake that has been let in.
+        return true;
+    }
+
+    if (busy()) {
+        const auto it = m_validated.find(address_key(src));
+        if (it == m_validated.end()) {
+            ++m_stats.deferred;
+            return false;
+        }
+        ++m_stats.validated;
+    }
+
+    if (m_pending_order.size() < MAX_ENTRIES) {
+        const auto expiry = now + m_handshake_timeout;
+        m_pending.emplace(key, expiry);
+        m_pending_order.emplace_back(expiry, std::move(key));
+    }
+    return true;
+}
+
+void admission_control::handshake_finished(const seastar::socket_address &peer, const bool succeeded) {
+    if (!m_threshold) {
+        return;
+    }
+
+    // Its entry in the order is dropped once it expires.
+    m_pending.erase(peer_key(peer));
+
+    if (!succeeded || m_validated_order.size() >= MAX_ENTRIES) {
+        return;
+    }
+    const auto expiry = clock::now() + m_validated_ttl;
+    std::string key = address_key(peer);
+    m_validated.insert_or_assign(key, expiry);
+    m_validated_order.emplace_back(expiry, std::move(key));
+}
+
+void admission_control::expire(const clock::time_point now) {
+    while (!m_pending_order.empty() && m_pending_order.front().first <= now) {
+        const auto &[expiry, key] = m_pending_order.front();
+        // The peer may have finished and started another handshake since.
+        if (const auto it = m_pending.find(key); it != m_pending.end() && it->second <= expiry) {
+            m_pending.erase(it);
+        }
+        m_pending_order.pop_front();
+    }
+
+    while (!m_validated_order.empty() && m_validated_order.front().first <= now) {
+        const auto &[expiry, key] = m_validated_order.front();
+        // A refreshed address has a later entry of its own.
+        if (const auto it = m_validated.find(key); it != m_validated.end() && it->second <= expiry) {
+            m_validated.erase(it);
+        }
+        m_validated_order.pop_front();
+    }
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
@@ -0,0 +1,110 @@
+#include <quic/detail/buffer_pool.hh>
+
+#include <algorithm>    // std::max, std::upper_bound
+#include <functional>   // std::less
+#include <iterator>     // std::prev
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+buffer_pool::slab_deleter::~slab_deleter() {
+    owner->has_deleter = false;
+    owner->pool->put(owner);
+}
+
+seastar::temporary_buffer<char> buffer_pool::buffer::to_temporary_buffer() && {
+    slab *s = m_slab;
+    char *data = get_write();
+    const auto size = m_size;
+
+    if (s->has_deleter) {
+        // Every buffer seastar owns shares the deleter, and with it a single reference.
+        ++s->deleter()->refs;
+        reset();
+    } else {
+        new (s->deleter_storage) slab_deleter(s);
+        s->has_deleter = true;
+        m_slab = nullptr;
+        m_size = 0;
+    }
+    return seastar::temporary_buffer<char>(data, size, seastar::deleter(s->deleter()));
+}
+
+buffer_pool::buffer_pool(const std::size_t slab_size)
+: m_slab_size(slab_size)
+, m_stride((HEADER_SIZE + slab_size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)) {}
+
+std::optional<buffer_pool::buffer> buffer_pool::get(const std::size_t size) {
+    if (size > m_slab_size) {
+        return std::nullopt;
+    }
+
+    if (m_free) {
+        ++m_stats.hits;
+    } else {
+        ++m_stats.misses;
+        grow();
+    }
+
+    slab *s = std::exchange(m_free, m_free->next_free);
+    s->next_free = nullptr;
+    s->refs = 1;
+
+    ++m_stats.in_use;
+    m_stats.high_water_mark = std::max(m_stats.high_water_mark, m_stats.in_use);
+
+    return buffer{s, size};
+}
+
+bool buffer_pool::owns(const void *ptr) const noexcept {
+    const auto *p = static_cast<const char*>(ptr);
+    const auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), p,
+            [] (const char *q, const std::unique_ptr<char[]> &chunk) { return q < chunk.get(); });
+    if (it == m_chunks.begin()) {
+        return false;
+    }
+
+    const char *begin = std::prev(it)->get();
+    const char *end   = begin + SLABS_PER_CHUNK * m_stride;
+    return p < end && static_cast<std::size_t>(p - begin) % m_stride == HEADER_SIZE;
+}
+
+buffer_pool::buffer buffer_pool::adopt(void *ptr, const std::size_t size) noexcept {
+    return buffer{reinterpret_cast<slab*>(static_cast<char*>(ptr) - HEADER_SIZE), size};
+}
+
+void buffer_pool::grow() {
+    std::unique_ptr<char[]> fresh(new char[SLABS_PER_CHUNK * m_stride]);
+    const auto position = std::upper_bound(m_chunks.begin(), m_chunks.end(), fresh,
+            [] (const auto &lhs, const auto &rhs) { return std::less<>{}(lhs.get(), rhs.get()); });
+    auto &chunk = *m_chunks.insert(position, std::move(fresh));
+
+    // Thread the new slabs in address order, so the first ones get used first.
+    for (std::size_t i = SLABS_PER_CHUNK; i-- > 0;) {
+        slab *s = new (chunk.get() + i * m_stride) slab{};
+        s->pool = this;
+        s->next_free = m_free;
+        m_free = s;
+    }
+
+    m_stats.capacity += SLABS_PER_CHUNK;
+}
+
+void buffer_pool::put(slab *s) noexcept {
+    if (--s->refs) {
+        return;
+    }
+
+    s->next_free = std::exchange(m_free, s);
+    --m_stats.in_use;
+}
+
+buffer_pool &local_buffer_pool() {
+    static thread_local buffer_pool pool(DATAGRAM_SIZE);
+    return pool;
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
@@ -4,105 +4,200 @@
 #include <quic/common.hh>
 #include <quic/quic_stream.hh>
 #include <quic/server.hh>
+#include <quic/detail/connection_registry.hh>
+#include <quic/detail/udp_socket.hh>
 
 #include <utils/logger.hh>
 
+#include <cerrno>
+#include <memory>   // std::addressof
+
 namespace zpp {
 namespace quic {
 namespace detail {
 
 namespace {
 
-using quic_stream_t = base_quic_stream<quic_stream_value_t>;
-
 constexpr std::size_t MAX_BYTES_TO_SEND = 1e8;
 
+using stream_direction_t = one_directionial_quic_stream<quic_stream_value_t>;
+
+std::size_t read_stream_data(void *lsqr_ctx, void *buffer, std::size_t count) {
+    auto *direction = reinterpret_cast<stream_direction_t*>(lsqr_ctx);
+    return direction->read_some(reinterpret_cast<quic_stream_value_t*>(buffer), count);
+}
+
+std::size_t stream_data_size(void *lsqr_ctx) {
+    return reinterpret_cast<stream_direction_t*>(lsqr_ctx)->size();
+}
+
+/** Copies the data lsquic has received on a stream into the stream's input buffer. */
+std::size_t deliver_stream_data(void *ctx, const unsigned char *buffer, std::size_t len, int fin) {
+    auto *direction = reinterpret_cast<stream_direction_t*>(ctx);
+    const std::size_t accepted = direction->write(reinterpret_cast<const quic_stream_value_t*>(buffer), len);
+    if (fin && accepted == len) {
+        direction->set_eof();
+    }
+    return accepted;
+}
+
 } // anonymous namespace
 
-lsquic_conn_ctx_t *on_new_connection([[maybe_unused]] void *stream_if_ctx, [[maybe_unused]] lsquic_conn_t *connection) {
-    logger::flog("Creating a new connection.");
-    return nullptr;
+lsquic_conn_ctx_t *on_new_connection(void *stream_if_ctx, lsquic_conn_t *connection) {
+    logger::dflog("Creating a new connection.");
+    server *srv = reinterpret_cast<server*>(stream_if_ctx);
+    connection_context *ctx = srv->m_connections.open_connection(connection);
+    if (srv->m_stopping) {
+        logger::dflog("The server is stopping. Closing the connection.");
+        lsquic_conn_close(connection);
+    }
+    return reinterpret_cast<lsquic_conn_ctx_t*>(ctx);
 }
 
 void on_connection_closed(lsquic_conn_t *connection) {
-    logger::flog("Closed a connection.");
+    logger::dflog("Closed a connection.");
+    auto *ctx = reinterpret_cast<connection_context*>(lsquic_conn_get_ctx(connection));
+    if (!ctx) {
+        return;
+    }
+
+    ctx->registry->close_connection(ctx);
+    lsquic_conn_set_ctx(connection, nullptr);
 }
 
 lsquic_stream_ctx_t *on_new_stream(void *stream_if_ctx, lsquic_stream *stream) {
-    lsquic_stream_wantread(stream, 0);
+    server *srv = reinterpret_cast<server*>(stream_if_ctx);
+    auto *conn_ctx = reinterpret_cast<connection_context*>(lsquic_conn_get_ctx(lsquic_stream_conn(stream)));
+    if (!conn_ctx) {
+        logger::eflog("A new stream on a connection without a context.");
+        lsquic_stream_close(stream);
+        return nullptr;
+    }
+
+    stream_context *ctx = srv->m_connections.open_stream(conn_ctx, stream);
+    if (srv->m_stopping) {
+        logger::dflog("The server is stopping. Closing the stream.");
+        lsquic_stream_close(stream);
+    } else if (!srv->m_accepted.push(ctx->get_reversed_wrapper())) {
+        logger::eflog("The application is not accepting streams. Closing the stream.");
+        lsquic_stream_close(stream);
+    }
+
+    lsquic_stream_wantread(stream, 1);
     lsquic_stream_wantwrite(stream, 1);
-    return reinterpret_cast<lsquic_stream_ctx_t*>(stream_if_ctx);   // TODO: To be changed to a map or something of streams
+    return reinterpret_cast<lsquic_stream_ctx_t*>(ctx);
 }
 
 void on_read(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx) {
-    quic_stream_t *qstream = reinterpret_cast<quic_stream_t*>(stream_ctx);
-    unsigned char buffer[1];
+    stream_context *qstream = reinterpret_cast<stream_context*>(stream_ctx);
+    auto &input = qstream->m_istream;
 
-    auto read_count = lsquic_stream_read(stream, buffer, sizeof(buffer));
+    const auto read_count = lsquic_stream_readf(stream, deliver_stream_data, std::addressof(input));
 
-    if (read_count > 0) {
-        logger::eflog("Received a non-zero value from lsquic.");
-    } else if (read_count == 0) {
-        logger::flog("Read an EOF.");
-        lsquic_stream_shutdown(stream, 0);
-        lsquic_stream_wantwrite(stream, 1);
-    } else {
+    if (read_count < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        // Reading resumed by stream_consumed before any data has arrived;
+        // lsquic calls again once there is some.
+        return;
+    } else if (read_count < 0) {
         logger::eflog("Error when reading from a stream. Aborting the connection.");
         lsquic_conn_abort(lsquic_stream_conn(stream));
+    } else if (input.eof() || (read_count == 0 && input.available())) {
+        logger::dflog("Read an EOF.");
+        input.set_eof();
+        lsquic_stream_shutdown(stream, 0);
+    } else if (input.above_high_watermark() || !input.available()) {
+        // Resumed by connection_registry::stream_consumed once the application catches up.
+        qstream->reading_paused = true;
+        lsquic_stream_wantread(stream, 0);
     }
 }
 
 void on_write(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx) {
-    static std::size_t send_counter = 0;
-
-    quic_stream_t *qstream = reinterpret_cast<quic_stream_t*>(stream_ctx);
+    stream_context *qstream = reinterpret_cast<stream_context*>(stream_ctx);
     if (!qstream->m_ostream.size()) {
+        // Woken up again by the application's next write.
+        lsquic_stream_wantwrite(stream, 0);
         return;
     }
 
-    auto write_count = lsquic_stream_write(
-        stream,
-        qstream->m_ostream.data(),
-        qstream->m_ostream.size()
-    );
+    // lsquic pulls the data straight out of the ring and the queued chunks.
+    lsquic_reader reader{
+        .lsqr_read  = read_stream_data,
+        .lsqr_size  = stream_data_size,
+        .lsqr_ctx   = std::addressof(qstream->m_ostream)
+    };
+    auto write_count = lsquic_stream_writef(stream, &reader);
 
     if (write_count > 0) {
-        qstream->m_ostream.drop(write_count);
-        send_counter += write_count;
+        qstream->bytes_sent += write_count;
 
-        if (!qstream->m_ostream.size() && send_counter >= MAX_BYTES_TO_SEND) {
-            logger::flog("Finished writing to a stream");
+        if (!qstream->m_ostream.size() && qstream->bytes_sent >= MAX_BYTES_TO_SEND) {
+            logger::dflog("Finished writing to a stream");
             lsquic_stream_shutdown(stream, 1);
             lsquic_conn_close(lsquic_stream_conn(stream));
         }
     } else if (write_count == -1) {
-        logger::eflog("stream_write() has returned ", write_count, ". Aborting the connection.");
+        logger::eflog("stream_writef() has returned ", write_count, ". Aborting the connection.");
         lsquic_conn_abort(lsquic_stream_conn(stream));
     }
 }
 
-void on_close(lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx) {
-    logger::flog("A stream has been closed.");
-}
+void on_close([[maybe_unused]] lsquic_stream_t *stream, lsquic_stream_ctx_t *stream_ctx) {
+    logger::dflog("A stream has been closed.");
+    if (!stream_ctx) {
+        return;
+    }
 
-// void    on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status handshake_status) {
+    stream_context *ctx = reinterpret_cast<stream_context*>(stream_ctx);
+    ctx->registry->close_stream(ctx);
+}
 
-// }
+void on_handshake_done(lsquic_conn_t *connection, lsquic_hsk_status handshake_status) {
+    auto *ctx = reinterpret_cast<connection_context*>(lsquic_conn_get_ctx(connection));
+    if (!ctx) {
+        return;
+    }
+    ctx->registry->handshake_finished(ctx, handshake_status);
+}
 
 int packets_out(void *packets_out_ctx, const lsquic_out_spec *specs, unsigned int count) {
-    for (std::size_t i = 0; i < count; ++i) {
-        server *srv = reinterpret_cast<server*>(specs[i].peer_ctx);
-        std::unique_ptr<quic_stream_value_t> data(new quic_stream_value_t[specs[i].iov->iov_len]);
-        std::memcpy(data.get(), specs[i].iov->iov_base, specs[i].iov->iov_len);
-        srv->m_udp_send_queue = srv->m_udp_send_queue.then(
-            [srv, data = std::move(data), dst = *specs[i].dest_sa, data_len = specs[i].iov->iov_len] {
-                seastar::socket_address addr(*reinterpret_cast<const sockaddr_in*>(&dst));
-                return srv->m_channel.send(addr, seastar::temporary_buffer<quic_stream_value_t>(data.get(), data_len));
-            }
-        );
+    server *srv = reinterpret_cast<server*>(packets_out_ctx);
+
+    unsigned int sent = 0;
+    for (; sent < count && !srv->send_queue_full(); ++sent) {
+        seastar::net::packet packet = srv->m_packet_memory.gather(specs[sent].iov, specs[sent].iovlen);
+        srv->m_bytes_out += packet.len();
+        srv->queue_datagram(to_socket_address(specs[sent].dest_sa), std::move(packet));
+    }
+    srv->m_packets_out += sent;
+
+    if (sent < count) {
+        // lsquic keeps the rest and waits for `lsquic_engine_send_unsent_packets`.
+        srv->m_sends_blocked = true;
+        ++srv->m_send_backoffs;
+        if (sent == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
     }
 
-    return count;
+    return sent;
+}
+
+void *packet_allocate(
+    void *pmi_ctx,
+    [[maybe_unused]] void *peer_ctx,
+    [[maybe_unused]] lsquic_conn_ctx_t *conn_ctx,
+    unsigned short size,
+    [[maybe_unused]] char is_ipv6)
+{
+    server *srv = reinterpret_cast<server*>(pmi_ctx);
+    return srv->m_packet_memory.allocate(size);
+}
+
+void packet_release(void *pmi_ctx, [[maybe_unused]] void *peer_ctx, void *buffer, [[maybe_unused]] char is_ipv6) {
+    server *srv = reinterpret_cast<server*>(pmi_ctx);
+    srv->m_packet_memory.release(buffer);
 }
 
 } // namespace detail
@@ -0,0 +1,114 @@
+#include <quic/detail/connection_registry.hh>
+
+#include <utils/logger.hh>
+
+#include <utility>  // std::exchange
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+stream_context::stream_context(connection_registry *reg, connection_context *conn, lsquic_stream_t *s) noexcept
+: base_quic_stream<quic_stream_value_t>(&connection_registry::dispose)
+, registry(reg)
+, connection(conn)
+, stream(s) {}
+
+connection_context *connection_registry::open_connection(lsquic_conn_t *connection) {
+    connection_context *result = m_connections.create(this, connection);
+    m_live_connections.push_back(*result);
+    return result;
+}
+
+void connection_registry::handshake_finished(connection_context *ctx, lsquic_hsk_status status) noexcept {
+    m_handshakes.record(ctx->connection, status);
+    if (std::exchange(ctx->handshake_finished, true)) {
+        return;
+    }
+    if (m_on_handshake) {
+        m_on_handshake(*ctx, status == LSQ_HSK_OK || status == LSQ_HSK_RESUMED_OK);
+    }
+}
+
+void connection_registry::close_connection(connection_context *ctx) noexcept {
+    if (!ctx->handshake_finished) {
+        ctx->handshake_finished = true;
+        if (m_on_handshake) {
+            m_on_handshake(*ctx, false);
+        }
+    }
+    if (m_on_close) {
+        m_on_close(*ctx);
+    }
+    if (!ctx->streams.empty()) {
+        logger::eflog("Closing a connection with ", ctx->streams.size(), " open streams.");
+        for (auto &[id, stream] : ctx->streams) {
+            stream->connection = nullptr;
+        }
+    }
+    m_connections.destroy(ctx);
+}
+
+stream_context *connection_registry::open_stream(connection_context *ctx, lsquic_stream_t *stream) {
+    stream_context *result = m_streams.create(this, ctx, stream);
+    result->set_max_buffer_size(m_max_stream_buffer);
+    result->set_watermarks(m_low_watermark, m_high_watermark);
+    result->set_hooks(&connection_registry::stream_written, &connection_registry::stream_consumed);
+    ctx->streams.emplace(lsquic_stream_id(stream), result);
+    m_live_streams.push_back(*result);
+    ++m_open_streams;
+    return result;
+}
+
+void connection_registry::close_stream(stream_context *ctx) noexcept {
+    if (ctx->connection) {
+        ctx->connection->streams.erase(lsquic_stream_id(ctx->stream));
+        ctx->connection = nullptr;
+    }
+    ctx->stream = nullptr;
+    ctx->mark_closed();
+    --m_open_streams;
+    ctx->release();
+}
+
+std::size_t connection_registry::buffered_bytes() const noexcept {
+    std::size_t result = 0;
+    for (const stream_context &ctx : m_live_streams) {
+        result += ctx.buffered_bytes();
+    }
+    return result;
+}
+
+void connection_registry::dispose(base_quic_stream<quic_stream_value_t> *stream) noexcept {
+    stream_context *ctx = static_cast<stream_context*>(stream);
+    ctx->registry->m_streams.destroy(ctx);
+}
+
+void connection_registry::stream_written(base_quic_stream<quic_stream_value_t> *stream) noexcept {
+    stream_context *ctx = static_cast<stream_context*>(stream);
+    if (!ctx->stream) {
+        return;
+    }
+
+    lsquic_stream_wantwrite(ctx->stream, 1);
+    if (ctx->registry->m_wakeup) {
+        ctx->registry->m_wakeup();
+    }
+}
+
+void connection_registry::stream_consumed(base_quic_stream<quic_stream_value_t> *stream) noexcept {
+    stream_context *ctx = static_cast<stream_context*>(stream);
+    if (!ctx->stream || !ctx->reading_paused) {
+        return;
+    }
+
+    ctx->reading_paused = false;
+    lsquic_stream_wantread(ctx->stream, 1);
+    if (ctx->registry->m_wakeup) {
+        ctx->registry->m_wakeup();
+    }
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
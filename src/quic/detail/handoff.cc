@@ -0,0 +1,266 @@
+#include <quic/detail/handoff.hh>
+
+#include <utils/logger.hh>
+
+#include <seastar/core/do_with.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/posix.hh>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>  // std::memcpy, std::strerror
+#include <tuple>
+
+#include <sys/socket.h>
+#include <sys/time.h>  // timeval
+#include <unistd.h>    // ::unlink, ::close
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+namespace {
+
+/** Tells a handoff apart from whatever else may be listening on the path. */
+constexpr std::uint32_t HANDOFF_MAGIC   = 0x7a707168;
+/** The most descriptors Linux passes in a single message (SCM_MAX_FD). */
+constexpr std::size_t   MAX_SOCKETS     = 253;
+constexpr char          HANDOFF_ACK     = 1;
+/** How long a successor waits for the sockets of its predecessor. */
+constexpr std::chrono::seconds TAKEOVER_TIMEOUT{5};
+
+/** Lets the relay of a draining predecessor ride out a burst. */
+constexpr int           RELAY_BUFFER    = 4 << 20;
+constexpr std::size_t   MAX_RELAYED_SIZE = 0xffff;
+
+/** Both ends are built from the same sources, so the layout needs no encoding. */
+struct handoff_header {
+    std::uint32_t   magic;
+    std::uint32_t   socket_count;
+    std::uint8_t    generation;
+};
+
+struct relay_header {
+    sockaddr_storage    source;
+    std::int32_t        ecn;
+};
+
+std::string error_text(const std::string &what) {
+    return what + ": " + std::strerror(errno);
+}
+
+sockaddr_un unix_address(const std::string &path) {
+    sockaddr_un address{};
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw handoff_error("Unusable path of a Unix socket: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+/** Binds a fresh socket to `address`, taking the place of a stale socket file. */
+seastar::file_desc bind_unix(const int type, sockaddr_un address) {
+    auto fd = seastar::file_desc::socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ::unlink(address.sun_path);
+    fd.bind(reinterpret_cast<sockaddr&>(address), sizeof(address));
+    return fd;
+}
+
+} // anonymous namespace
+
+takeover take_over(const std::string &path, const std::size_t shards) {
+    const sockaddr_un address = unix_address(path);
+    const int raw = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (raw < 0) {
+        throw handoff_error(error_text("Cannot create a Unix socket"));
+    }
+    seastar::file_desc fd = seastar::file_desc::from_fd(raw);
+
+    const timeval timeout{.tv_sec = TAKEOVER_TIMEOUT.count(), .tv_usec = 0};
+    ::setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (::connect(fd.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        throw handoff_error(error_text("Cannot connect to " + path));
+    }
+
+    handoff_header header{};
+    iovec iov{&header, sizeof(header)};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_SOCKETS));
+    msghdr message{};
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.data();
+    message.msg_controllen = control.size();
+
+    ssize_t received;
+    do {
+        received = ::recvmsg(fd.get(), &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+        throw handoff_error(error_text("Receiving the sockets from " + path + " has failed"));
+    }
+
+    takeover result{.generation = header.generation, .sockets = {}};
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const std::size_t first = result.sockets.size();
+        result.sockets.resize(first + count);
+        std::memcpy(&result.sockets[first], CMSG_DATA(cmsg), count * sizeof(int));
+    }
+
+    auto fail = [&result] (const std::string &what) {
+        for (const int received_fd : result.sockets) {
+            ::close(received_fd);
+        }
+        return handoff_error(what);
+    };
+    if (static_cast<std::size_t>(received) != sizeof(header) || header.magic != HANDOFF_MAGIC
+            || (message.msg_flags & MSG_CTRUNC) || result.sockets.size() != header.socket_count) {
+        throw fail("The process listening on " + path + " has not handed its sockets over.");
+    }
+    if (result.sockets.size() != shards) {
+        // Without the confirmation, the predecessor goes on reading them.
+        throw fail("The process listening on " + path + " runs " + std::to_string(result.sockets.size())
+                + " shards instead of " + std::to_string(shards) + '.');
+    }
+    if (::send(fd.get(), &HANDOFF_ACK, sizeof(HANDOFF_ACK), MSG_NOSIGNAL) != sizeof(HANDOFF_ACK)) {
+        throw fail(error_text("Confirming the handoff to " + path + " has failed"));
+    }
+    return result;
+}
+
+seastar::future<> successor::hand_over(const std::uint8_t generation, const std::vector<int> &sockets) {
+    if (sockets.empty() || sockets.size() > MAX_SOCKETS) {
+        return seastar::make_exception_future<>(handoff_error(
+                "Cannot hand over " + std::to_string(sockets.size()) + " sockets."));
+    }
+
+    handoff_header header{
+        .magic          = HANDOFF_MAGIC,
+        .socket_count   = static_cast<std::uint32_t>(sockets.size()),
+        .generation     = generation
+    };
+    iovec iov{&header, sizeof(header)};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * sockets.size()));
+    msghdr message{};
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.data();
+    message.msg_controllen = control.size();
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * sockets.size());
+    std::memcpy(CMSG_DATA(cmsg), sockets.data(), sizeof(int) * sockets.size());
+
+    // The message is far smaller than the buffer of a fresh Unix socket, so it
+    // goes out at once even though the socket doesn't block.
+    if (::sendmsg(m_fd.get_file_desc().get(), &message, MSG_NOSIGNAL) != sizeof(header)) {
+        return seastar::make_exception_future<>(handoff_error(error_text("Handing the sockets over has failed")));
+    }
+
+    return seastar::do_with(char{}, [this] (char &ack) {
+        return m_fd.read_some(&ack, sizeof(ack)).then([&ack] (std::size_t size) {
+            if (size != sizeof(ack) || ack != HANDOFF_ACK) {
+                throw handoff_error("The successor has not confirmed the handoff.");
+            }
+        });
+    });
+}
+
+seastar::future<successor> wait_for_successor(const std::string &path) {
+    return seastar::futurize_invoke([&path] {
+        auto fd = bind_unix(SOCK_STREAM, unix_address(path));
+        fd.listen(1);
+        return seastar::pollable_fd(std::move(fd));
+    }).then([] (seastar::pollable_fd listener) {
+        return seastar::do_with(std::move(listener), [] (seastar::pollable_fd &listener) {
+            return listener.accept().then([] (std::tuple<seastar::pollable_fd, seastar::socket_address> accepted) {
+                return successor(std::move(std::get<0>(accepted)));
+            });
+        });
+    });
+}
+
+sockaddr_un relay_address(const std::string &path, const std::uint8_t generation, const unsigned shard) {
+    return unix_address(path + '.' + std::to_string(generation) + '.' + std::to_string(shard));
+}
+
+datagram_relay::datagram_relay()
+: m_fd(seastar::file_desc::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) {}
+
+datagram_relay::datagram_relay(const sockaddr_un &address)
+: m_fd(bind_unix(SOCK_DGRAM, address))
+, m_buffer(std::make_unique<unsigned char[]>(sizeof(relay_header) + MAX_RELAYED_SIZE))
+{
+    // Only a hint; the default queue just drops more during a burst.
+    ::setsockopt(m_fd.get_file_desc().get(), SOL_SOCKET, SO_RCVBUF, &RELAY_BUFFER, sizeof(RELAY_BUFFER));
+}
+
+relay_result datagram_relay::send(const sockaddr_un &to, const unsigned char *data, const std::size_t size,
+        const seastar::socket_address &src, const int ecn) noexcept {
+    relay_header header{};
+    std::memcpy(&header.source, &src.as_posix_sockaddr(), src.length());
+    header.ecn = ecn;
+
+    iovec iov[2] = {
+        {&header, sizeof(header)},
+        {const_cast<unsigned char*>(data), size}
+    };
+    msghdr message{};
+    message.msg_name    = const_cast<sockaddr_un*>(&to);
+    message.msg_namelen = sizeof(to);
+    message.msg_iov     = iov;
+    message.msg_iovlen  = 2;
+
+    for (;;) {
+        if (::sendmsg(m_fd.get_file_desc().get(), &message, MSG_NOSIGNAL) >= 0) {
+            return relay_result::sent;
+        }
+        switch (errno) {
+        case EINTR:
+            continue;
+        case ECONNREFUSED:
+        case ENOENT:
+        case ENOTCONN:
+            return relay_result::gone;
+        default:
+            return relay_result::dropped;
+        }
+    }
+}
+
+std::size_t datagram_relay::receive(const std::size_t max, udp_socket::receive_handler &handler) {
+    std::size_t received = 0;
+    while (received < max) {
+        const ssize_t size = ::recv(m_fd.get_file_desc().get(), m_buffer.get(),
+                sizeof(relay_header) + MAX_RELAYED_SIZE, 0);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logger::eflog("Receiving relayed datagrams has failed: ", std::strerror(errno));
+            }
+            break;
+        }
+        if (static_cast<std::size_t>(size) < sizeof(relay_header)) {
+            continue;
+        }
+
+        relay_header header;
+        std::memcpy(&header, m_buffer.get(), sizeof(header));
+        handler(m_buffer.get() + sizeof(header), size - sizeof(header),
+                to_socket_address(reinterpret_cast<const sockaddr*>(&header.source)), header.ecn);
+        ++received;
+    }
+    return received;
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
@@ -0,0 +1,60 @@
+#include <quic/detail/packet_memory.hh>
+
+#include <utils/logger.hh>
+
+#include <cstring>  // std::memcpy
+#include <utility>  // std::move
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+void *packet_memory::allocate(const std::size_t size) {
+    if (auto buffer = m_pool->get(size)) {
+        // The reference is handed over to lsquic and taken back in `release`.
+        return buffer->release();
+    }
+
+    seastar::temporary_buffer<char> buffer(size);
+    void *const result = buffer.get_write();
+    m_oversized.emplace(result, std::move(buffer));
+    return result;
+}
+
+void packet_memory::release(void *buffer) {
+    if (m_pool->owns(buffer)) {
+        m_pool->adopt(buffer, 0);
+    } else if (!m_oversized.erase(buffer)) {
+        logger::eflog("Releasing a packet buffer that has not been allocated by the server.");
+    }
+}
+
+seastar::net::packet packet_memory::gather(const iovec *iov, const std::size_t iovlen) {
+    seastar::net::packet result{};
+
+    for (std::size_t i = 0; i < iovlen; ++i) {
+        auto       *base = static_cast<char*>(iov[i].iov_base);
+        const auto  len  = iov[i].iov_len;
+
+        if (m_pool->owns(base)) {
+            result = seastar::net::packet(std::move(result), m_pool->share(base, len).to_temporary_buffer());
+            continue;
+        }
+
+        auto it = m_oversized.find(base);
+        if (it != m_oversized.end() && len <= it->second.size()) {
+            result = seastar::net::packet(std::move(result), it->second.share(0, len));
+        } else {
+            // Not a buffer of ours, so it dies together with the lsquic call.
+            seastar::temporary_buffer<char> copy(len);
+            std::memcpy(copy.get_write(), base, len);
+            result = seastar::net::packet(std::move(result), std::move(copy));
+        }
+    }
+
+    return result;
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
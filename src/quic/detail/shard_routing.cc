@@ -0,0 +1,86 @@
+#include <quic/detail/shard_routing.hh>
+
+#include <seastar/core/smp.hh>
+
+#include <openssl/rand.h>
+
+#include <cstdint>
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+namespace {
+
+constexpr std::uint32_t QUIC_V2 = 0x6b3343cf;
+constexpr std::uint8_t  GENERATION_BIT = 0x80;
+
+/** Written once before the shards start, read-only afterwards. */
+std::uint8_t generation = 0;
+
+bool is_ietf_version(const std::uint32_t version) noexcept {
+    return version == 1 || version == QUIC_V2 || (version >> 8) == 0xff0000;
+}
+
+} // anonymous namespace
+
+void set_cid_generation(const std::uint8_t value) noexcept {
+    generation = value & 1;
+}
+
+std::uint8_t cid_generation() noexcept {
+    return generation;
+}
+
+bool issued_by_other_generation(const unsigned char *data, const std::size_t size) noexcept {
+    if (size < 6 || !(data[0] & 0x40)) {
+        return false;
+    }
+    if (data[0] & 0x80) {
+        const std::uint32_t version = (std::uint32_t{data[1]} << 24) | (std::uint32_t{data[2]} << 16)
+                | (std::uint32_t{data[3]} << 8) | std::uint32_t{data[4]};
+        const unsigned type = (data[0] >> 4) & 0x3;
+        // Handshake packets are of type 2, or 3 in QUIC v2.
+        if (!is_ietf_version(version) || type != (version == QUIC_V2 ? 3u : 2u)) {
+            return false;
+        }
+    }
+
+    lsquic_cid_t dcid;
+    if (lsquic_cid_from_packet(data, size, &dcid) != 0 || dcid.len < 2) {
+        return false;
+    }
+    return ((dcid.idbuf[1] & GENERATION_BIT) != 0) != (generation != 0);
+}
+
+unsigned owner_shard(const lsquic_cid_t &dcid) noexcept {
+    if (!dcid.len) {
+        return seastar::this_shard_id();
+    }
+    return dcid.idbuf[0] % seastar::smp::count;
+}
+
+unsigned route_datagram(const unsigned char *data, const std::size_t size) noexcept {
+    lsquic_cid_t dcid;
+    if (seastar::smp::count == 1 || lsquic_cid_from_packet(data, size, &dcid) != 0) {
+        return seastar::this_shard_id();
+    }
+    return owner_shard(dcid);
+}
+
+void generate_scid([[maybe_unused]] void *ctx, [[maybe_unused]] lsquic_conn_t *connection, lsquic_cid_t *scid, unsigned len) {
+    // A single byte is enough to tell the shards apart; seastar doesn't run
+    // anywhere near 256 of them per process.
+    scid->len = len;
+    RAND_bytes(scid->idbuf, len);
+    if (len) {
+        scid->idbuf[0] = static_cast<std::uint8_t>(seastar::this_shard_id());
+    }
+    if (len > 1) {
+        scid->idbuf[1] = (scid->idbuf[1] & ~GENERATION_BIT) | (generation ? GENERATION_BIT : 0);
+    }
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
@@ -0,0 +1,176 @@
+#include <quic/detail/transport_stats.hh>
+
+#include <utils/logger.hh>
+
+#include <seastar/core/smp.hh>
+
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>  // std::setw, std::setfill
+#include <mutex>
+#include <thread>
+#include <utility>  // std::exchange
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+/** @brief Appends the lines handed over by a shard to a file, from a thread of its own. */
+class transport_stats::dump_writer {
+private:
+    /** Lines beyond this, waiting for a stalled disk, are dropped. */
+    static constexpr std::size_t MAX_QUEUED_BYTES = 16 << 20;
+
+    std::ofstream           m_out;
+    std::mutex              m_mutex{};
+    std::condition_variable m_wakeup{};
+    std::string             m_queued{};
+    bool                    m_stopping  = false;
+    std::thread             m_thread;
+
+public:
+    explicit dump_writer(std::ofstream out)
+    : m_out(std::move(out))
+    , m_thread([this] { run(); }) {}
+
+    /** @brief Writes out whatever is still queued. */
+    ~dump_writer() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_one();
+        m_thread.join();
+    }
+
+    /** @return false if the lines have been dropped. */
+    bool submit(const std::string &lines) {
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_queued.size() + lines.size() > MAX_QUEUED_BYTES) {
+                return false;
+            }
+            m_queued += lines;
+        }
+        m_wakeup.notify_one();
+        return true;
+    }
+
+private:
+    void run() {
+        std::unique_lock lock(m_mutex);
+        for (;;) {
+            m_wakeup.wait(lock, [this] { return m_stopping || !m_queued.empty(); });
+            if (m_queued.empty()) {
+                return;
+            }
+
+            const std::string lines = std::exchange(m_queued, {});
+            lock.unlock();
+            m_out << lines;
+            m_out.flush();
+            lock.lock();
+        }
+    }
+};
+
+bool connection_stats::update(lsquic_conn_t *connection) noexcept {
+    if (lsquic_conn_get_info(connection, &info) != 0) {
+        return false;
+    }
+    sampled = true;
+    return true;
+}
+
+transport_stats::transport_stats() = default;
+transport_stats::transport_stats(transport_stats&&) noexcept = default;
+transport_stats &transport_stats::operator=(transport_stats&&) noexcept = default;
+
+transport_stats::~transport_stats() {
+    flush();
+}
+
+void transport_stats::dump_to(const std::string &path) {
+    std::ofstream out(path, std::ios::out | std::ios::app);
+    if (!out) {
+        logger::eflog("Cannot open ", path, " for the connection statistics.");
+        return;
+    }
+    flush();
+    m_dump = std::make_unique<dump_writer>(std::move(out));
+}
+
+void transport_stats::sample(lsquic_conn_t *connection, connection_stats &stats) noexcept {
+    if (stats.update(connection)) {
+        add_sample(stats.info);
+    }
+}
+
+void transport_stats::closed(lsquic_conn_t *connection, connection_stats &stats) {
+    ++m_closed;
+    // A failed update keeps the last sample, if there's any.
+    if (!stats.update(connection) && !stats.sampled) {
+        return;
+    }
+
+    add_sample(stats.info);
+    m_packets_lost += stats.info.lci_pkts_lost;
+    m_packets_retx += stats.info.lci_pkts_retx;
+    m_lost_per_connection.add(stats.info.lci_pkts_lost);
+    m_retx_per_connection.add(stats.info.lci_pkts_retx);
+
+    if (m_dump) {
+        write_json(connection, stats);
+    }
+}
+
+void transport_stats::flush() {
+    if (!m_dump || m_lines.view().empty()) {
+        return;
+    }
+    if (!m_dump->submit(m_lines.str())) {
+        logger::eflog("The connection statistics are written out too slowly; dropping some of them.");
+    }
+    m_lines.str({});
+}
+
+void transport_stats::add_sample(const lsquic_conn_info &info) noexcept {
+    ++m_samples;
+    m_rtt.add(info.lci_rtt);
+    m_cwnd.add(info.lci_cwnd);
+}
+
+void transport_stats::write_json(lsquic_conn_t *connection, const connection_stats &stats) {
+    const auto lifetime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - stats.opened_at);
+    const lsquic_conn_info &info = stats.info;
+    std::ostringstream &out = m_lines;
+
+    out << "{\"shard\":" << seastar::this_shard_id() << ",\"cid\":\"";
+    if (const lsquic_cid_t *cid = lsquic_conn_id(connection)) {
+        const auto flags = out.flags();
+        out << std::hex << std::setfill('0');
+        for (unsigned i = 0; i < cid->len; ++i) {
+            out << std::setw(2) << static_cast<unsigned>(cid->idbuf[i]);
+        }
+        out.flags(flags);
+    }
+    out << "\",\"lifetime_ms\":"            << lifetime.count()
+        << ",\"rtt_us\":"                   << info.lci_rtt
+        << ",\"rttvar_us\":"                << info.lci_rttvar
+        << ",\"min_rtt_us\":"               << info.lci_rtt_min
+        << ",\"cwnd\":"                     << info.lci_cwnd
+        << ",\"pmtu\":"                     << info.lci_pmtu
+        << ",\"bytes_sent\":"               << info.lci_bytes_sent
+        << ",\"bytes_received\":"           << info.lci_bytes_rcvd
+        << ",\"packets_sent\":"             << info.lci_pkts_sent
+        << ",\"packets_received\":"         << info.lci_pkts_rcvd
+        << ",\"packets_lost\":"             << info.lci_pkts_lost
+        << ",\"packets_retransmitted\":"    << info.lci_pkts_retx
+        << ",\"bandwidth_estimate\":"       << info.lci_bw_estimate
+        << "}\n";
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
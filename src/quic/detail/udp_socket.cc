@@ -0,0 +1,347 @@
+#include <quic/detail/udp_socket.hh>
+
+#include <utils/logger.hh>
+
+#include <seastar/core/loop.hh>
+#include <seastar/core/posix.hh>
+
+#include <algorithm>  // std::min
+#include <array>
+#include <cerrno>
+#include <cstring>  // std::strerror
+#include <utility>  // std::move
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace zpp {
+namespace quic {
+namespace detail {
+
+namespace {
+
+union segment_control {
+    cmsghdr header;
+    char    buffer[CMSG_SPACE(sizeof(std::uint16_t))];
+};
+
+/** Room for the GRO segment size and the TOS byte of a received message. */
+union receive_control {
+    cmsghdr header;
+    char    buffer[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(int))];
+};
+
+/** Messages received at once with GRO; each of them may take 64 KiB. */
+constexpr std::size_t MAX_GRO_MESSAGES = 8;
+constexpr std::size_t MAX_GRO_BYTES    = 0xffff;
+
+seastar::file_desc bind_socket(const std::uint16_t port) {
+    auto fd = seastar::file_desc::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    fd.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    fd.bind(reinterpret_cast<sockaddr&>(address), sizeof(address));
+    return fd;
+}
+
+bool kernel_supports_gso(const int fd) noexcept {
+    int segment_size = 0;
+    socklen_t len = sizeof(segment_size);
+    return ::getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment_size, &len) == 0;
+}
+
+bool enable_gro(const int fd) noexcept {
+    const int on = 1;
+    return ::setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+}
+
+bool enable_ecn(const int fd) noexcept {
+    const int on = 1;
+    return ::setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) == 0;
+}
+
+} // anonymous namespace
+
+seastar::socket_address to_socket_address(const sockaddr *sa) {
+    if (sa->sa_family == AF_INET6) {
+        return seastar::socket_address(*reinterpret_cast<const sockaddr_in6*>(sa));
+    }
+    return seastar::socket_address(*reinterpret_cast<const sockaddr_in*>(sa));
+}
+
+struct udp_socket::scratch {
+    static constexpr std::size_t MAX_IOVECS = 1024;
+
+    std::array<mmsghdr, MAX_MESSAGES>           messages;
+    /** Datagrams carried by each message. */
+    std::array<std::size_t, MAX_MESSAGES>       datagrams;
+    std::array<segment_control, MAX_MESSAGES>   controls;
+    std::array<iovec, MAX_IOVECS>               iovecs;
+
+    std::array<mmsghdr, MAX_MESSAGES>           received;
+    std::array<iovec, MAX_MESSAGES>             receive_iovecs;
+    std::array<sockaddr_storage, MAX_MESSAGES>  sources;
+    std::array<receive_control, MAX_MESSAGES>   receive_controls;
+    /** `receive_slots` buffers of `receive_slot_size` bytes, one per message. */
+    std::unique_ptr<unsigned char[]>            receive_buffer;
+    std::size_t                                 receive_slot_size;
+    std::size_t                                 receive_slots;
+};
+
+udp_socket::udp_socket(const std::uint16_t port, const bool gso, const bool gro)
+: udp_socket(bind_socket(port), gso, gro) {}
+
+udp_socket::udp_socket(seastar::file_desc fd, const bool gso, const bool gro)
+: m_fd(std::move(fd))
+, m_gso(gso && kernel_supports_gso(m_fd.get_file_desc().get()))
+, m_gro(gro && enable_gro(m_fd.get_file_desc().get()))
+, m_ecn(enable_ecn(m_fd.get_file_desc().get()))
+, m_scratch(std::make_unique<scratch>())
+{
+    sockaddr_in address{};
+    socklen_t len = sizeof(address);
+    ::getsockname(m_fd.get_file_desc().get(), reinterpret_cast<sockaddr*>(&address), &len);
+    m_local = seastar::socket_address(address);
+
+    if (gso && !m_gso) {
+        logger::eflog("UDP GSO is not supported by the kernel, sending datagrams one by one.");
+    }
+    if (gro && !m_gro) {
+        logger::eflog("UDP GRO is not supported by the kernel, receiving datagrams one by one.");
+    }
+
+    scratch &s = *m_scratch;
+    s.receive_slot_size = m_gro ? MAX_GRO_BYTES : DATAGRAM_SIZE;
+    s.receive_slots     = m_gro ? MAX_GRO_MESSAGES : MAX_MESSAGES;
+    s.receive_buffer    = std::make_unique<unsigned char[]>(s.receive_slot_size * s.receive_slots);
+}
+
+udp_socket::udp_socket(udp_socket&&) noexcept = default;
+udp_socket &udp_socket::operator=(udp_socket&&) noexcept = default;
+udp_socket::~udp_socket() = default;
+
+seastar::future<> udp_socket::send(seastar::circular_buffer<outgoing_datagram> &queue) {
+    return seastar::repeat([this, &queue] {
+        if (queue.empty()) {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+        if (send_some(queue) > 0) {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+        }
+        return m_fd.writeable().then([] {
+            return seastar::stop_iteration::no;
+        });
+    });
+}
+
+std::size_t udp_socket::send_some(seastar::circular_buffer<outgoing_datagram> &queue) {
+    scratch &s = *m_scratch;
+
+    std::size_t message_count = 0;
+    std::size_t iovec_count   = 0;
+    std::size_t queued        = 0;
+
+    while (message_count < MAX_MESSAGES && queued < queue.size()) {
+        const outgoing_datagram &first = queue[queued];
+        if (iovec_count + first.packet.nr_frags() > s.iovecs.size()) {
+            break;
+        }
+
+        const std::size_t segment_size = first.packet.len();
+        const std::size_t first_iovec  = iovec_count;
+        std::size_t datagrams = 0;
+        std::size_t bytes     = 0;
+
+        auto add = [&] (const outgoing_datagram &datagram) {
+            for (const auto &fragment : datagram.packet.fragments()) {
+                s.iovecs[iovec_count++] = iovec{fragment.base, fragment.size};
+            }
+            bytes += datagram.packet.len();
+            ++datagrams;
+        };
+
+        add(first);
+        // A GSO message is cut into datagrams of `segment_size` bytes, only
+        // the last of which may be shorter.
+        while (m_gso && datagrams < MAX_GSO_SEGMENTS && queued + datagrams < queue.size()) {
+            const outgoing_datagram &next = queue[queued + datagrams];
+            if (next.destination != first.destination
+                    || next.packet.len() > segment_size
+                    || bytes + next.packet.len() > MAX_GSO_BYTES
+                    || iovec_count + next.packet.nr_frags() > s.iovecs.size()) {
+                break;
+            }
+            add(next);
+            if (next.packet.len() < segment_size) {
+                break;
+            }
+        }
+
+        mmsghdr &message = s.messages[message_count];
+        message = mmsghdr{};
+        message.msg_hdr.msg_name    = const_cast<sockaddr*>(&first.destination.as_posix_sockaddr());
+        message.msg_hdr.msg_namelen = first.destination.length();
+        message.msg_hdr.msg_iov     = &s.iovecs[first_iovec];
+        message.msg_hdr.msg_iovlen  = iovec_count - first_iovec;
+
+        if (datagrams > 1) {
+            segment_control &control = s.controls[message_count];
+            message.msg_hdr.msg_control    = control.buffer;
+            message.msg_hdr.msg_controllen = sizeof(control.buffer);
+
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type  = UDP_SEGMENT;
+            cmsg->cmsg_len   = CMSG_LEN(sizeof(std::uint16_t));
+            const auto segment = static_cast<std::uint16_t>(segment_size);
+            std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+        }
+
+        s.datagrams[message_count++] = datagrams;
+        queued += datagrams;
+    }
+
+    for (;;) {
+        const int sent = ::sendmmsg(m_fd.get_file_desc().get(), s.messages.data(), message_count, 0);
+        if (sent > 0) {
+            std::size_t done = 0;
+            for (int i = 0; i < sent; ++i) {
+                done += s.datagrams[i];
+                m_stats.gso_messages += s.datagrams[i] > 1;
+            }
+            for (std::size_t i = 0; i < done; ++i) {
+                queue.pop_front();
+            }
+            ++m_stats.send_calls;
+            m_stats.datagrams_sent += done;
+            return done;
+        }
+
+        switch (errno) {
+        case EINTR:
+            continue;
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            return 0;
+        case EIO:
+            if (s.datagrams[0] > 1) {
+                // The device can't checksum segments; GSO stays off from now on.
+                logger::eflog("UDP GSO has failed, sending datagrams one by one.");
+                m_gso = false;
+                return send_some(queue);
+            }
+            [[fallthrough]];
+        default:
+            // The first message can't be sent. It is dropped like the
+            // channel drops a datagram it fails to send.
+            logger::eflog("Sending a datagram has failed: ", std::strerror(errno));
+            ++m_stats.send_errors;
+            for (std::size_t i = 0; i < s.datagrams[0]; ++i) {
+                queue.pop_front();
+            }
+            return s.datagrams[0];
+        }
+    }
+}
+
+std::size_t udp_socket::receive(const std::size_t max, receive_handler &handler) {
+    scratch &s = *m_scratch;
+    std::size_t received = 0;
+
+    while (received < max) {
+        const std::size_t wanted = std::min(s.receive_slots, max - received);
+        for (std::size_t i = 0; i < wanted; ++i) {
+            s.receive_iovecs[i] = iovec{&s.receive_buffer[i * s.receive_slot_size], s.receive_slot_size};
+
+            msghdr &message = s.received[i].msg_hdr;
+            message = msghdr{};
+            message.msg_name       = &s.sources[i];
+            message.msg_namelen    = sizeof(s.sources[i]);
+            message.msg_iov        = &s.receive_iovecs[i];
+            message.msg_iovlen     = 1;
+            message.msg_control    = s.receive_controls[i].buffer;
+            message.msg_controllen = sizeof(s.receive_controls[i].buffer);
+        }
+
+        const int count = ::recvmmsg(m_fd.get_file_desc().get(), s.received.data(), wanted, 0, nullptr);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logger::eflog("Receiving datagrams has failed: ", std::strerror(errno));
+            }
+            break;
+        }
+
+        ++m_stats.receive_calls;
+        for (int i = 0; i < count; ++i) {
+            received += deliver(s.received[i], handler);
+        }
+
+        if (static_cast<std::size_t>(count) < wanted) {
+            // The socket has been drained.
+            break;
+        }
+    }
+
+    m_stats.datagrams_received += received;
+    return received;
+}
+
+std::size_t udp_socket::deliver(mmsghdr &message, receive_handler &handler) {
+    msghdr &header = message.msg_hdr;
+    if (header.msg_flags & MSG_TRUNC) {
+        logger::eflog("Dropping a datagram larger than ", m_scratch->receive_slot_size, " bytes.");
+        return 1;
+    }
+
+    std::size_t segment_size = message.msg_len;
+    int ecn = 0;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            if (size > 0) {
+                segment_size = static_cast<std::size_t>(size);
+            }
+        } else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS) {
+            unsigned char tos;
+            std::memcpy(&tos, CMSG_DATA(cmsg), sizeof(tos));
+            ecn = tos & IPTOS_ECN_MASK;
+        }
+    }
+
+    const auto source = to_socket_address(reinterpret_cast<const sockaddr*>(header.msg_name));
+    const auto *data  = reinterpret_cast<const unsigned char*>(header.msg_iov->iov_base);
+
+    // GRO glues datagrams of one flow together; all but the last one are
+    // exactly `segment_size` bytes long.
+    std::size_t datagrams = 0;
+    for (std::size_t offset = 0; offset < message.msg_len; offset += segment_size) {
+        handler(data + offset, std::min<std::size_t>(segment_size, message.msg_len - offset), source, ecn);
+        ++datagrams;
+    }
+
+    m_stats.gro_messages += datagrams > 1;
+    return datagrams;
+}
+
+} // namespace detail
+} // namespace quic
+} // namespace zpp
@@ -5,12 +5,22 @@
 
 #include <utils/logger.hh>
 
+#include <seastar/core/loop.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/when_all.hh>
+
+#include <quic/detail/buffer_pool.hh>
 #include <quic/detail/callbacks.hh>
-#include <quic/ssl/ssl_handler.hh>
+#include <quic/detail/shard_routing.hh>
+#include <quic/ssl/certificate_store.hh>
 
 #include <cstdint>  // std::uint16_t, std::int64_t
 #include <cstring>  // std::memset
 #include <chrono>
+#include <optional>
+#include <vector>
 
 namespace zpp {
 namespace quic {
@@ -23,47 +33,66 @@ constinit lsquic_stream_if SERVER_CALLBACKS = {
     .on_new_stream  = ::zpp::quic::detail::on_new_stream,
     .on_read        = ::zpp::quic::detail::on_read,
     .on_write       = ::zpp::quic::detail::on_write,
-    .on_close       = ::zpp::quic::detail::on_close
+    .on_close       = ::zpp::quic::detail::on_close,
+    .on_hsk_done    = ::zpp::quic::detail::on_handshake_done
 };
 
-SSL_CTX *server_ssl_ctx = nullptr;
+constinit lsquic_packout_mem_if SERVER_PACKET_MEMORY = {
+    .pmi_allocate   = ::zpp::quic::detail::packet_allocate,
+    .pmi_release    = ::zpp::quic::detail::packet_release,
+    .pmi_return     = ::zpp::quic::detail::packet_release
+};
 
-inline void load_server_cert() {
-    if (server_ssl_ctx) {
-        return;
-    }
+/** Maximum number of datagrams a shard may have on their way to other shards. */
+constexpr std::size_t MAX_FORWARDS_IN_FLIGHT = 1024;
 
-    constexpr const char *cert_file = "../ssl/mycert-cert.pem";
-    constexpr const char *key_file  = "../ssl/mycert-key.pem";
+/** The server running on the current shard, if any. */
+thread_local server *shard_server = nullptr;
 
-    if (ssl::load_cert(cert_file, key_file, std::addressof(server_ssl_ctx))) {
-        logger::ffail("Cannot load the certificates.");
-    }
+SSL_CTX *get_server_ssl_ctx([[maybe_unused]] void *peer_ctx, [[maybe_unused]] const ::sockaddr *local) {
+    const ssl::certificate_store *store = ssl::local_certificates();
+    return store ? store->default_context() : nullptr;
 }
 
-SSL_CTX *get_server_ssl_ctx([[maybe_unused]] void *peer_ctx, [[maybe_unused]] const ::sockaddr *local) {
-    return server_ssl_ctx;
+/** Picks the context of the name the client asks for; looked up again after every reload. */
+SSL_CTX *lookup_server_cert([[maybe_unused]] void *ctx, [[maybe_unused]] const ::sockaddr *local, const char *sni) {
+    const ssl::certificate_store *store = ssl::local_certificates();
+    return store ? store->find(sni) : nullptr;
 }
 
 } // anonymous namespace
 
-server::~server() {
-    if (m_stream) {
-        delete std::exchange(m_stream, nullptr);
+std::optional<detail::udp_socket> server::make_socket(const std::uint16_t port, const udp_options &udp) {
+    if (udp.socket_fd >= 0) {
+        return std::optional<detail::udp_socket>(std::in_place, seastar::file_desc::from_fd(udp.socket_fd), udp.gso, udp.gro);
     }
+    return std::optional<detail::udp_socket>(std::in_place, port, udp.gso, udp.gro);
 }
 
-void server::init_lsquic(detail::base_quic_stream<quic_stream_value_t> *stream) {
-    m_stream = stream;
+server::~server() {
+    // A server that hasn't been stopped drops its connections without a word.
+    if (m_engine) {
+        m_input_closed = true;
+        lsquic_engine_destroy(m_engine);
+        m_engine = nullptr;
+    }
+    if (shard_server == this) {
+        shard_server = nullptr;
+    }
+}
 
+void server::init_lsquic() {
     logger::flog("Initialising an lsquic engine.");
+    if (seastar::smp::count > 0x100) {
+        logger::ffail("Connection IDs can tell apart at most 256 shards.");
+    }
+
     if (lsquic_global_init(LSQUIC_GLOBAL_SERVER) != 0) {
         logger::ffail("Initialisation of the engine has failed.");
     }
 
-    load_server_cert();
-    if (!server_ssl_ctx) {
-        logger::ffail("SSL server context is a null.");
+    if (!ssl::local_certificates()) {
+        logger::ffail("No certificates have been installed.");
     }
 
     lsquic_engine_settings settings{};
@@ -72,9 +101,10 @@ void server::init_lsquic(detail::base_quic_stream<quic_stream_value_t> *stream)
     char errbuf[0x100];
 
     settings.es_ql_bits = 0;
+    m_engine_config.fill(settings);
 
     if (lsquic_engine_check_settings(&settings, LSENG_SERVER, errbuf, sizeof(errbuf)) != 0) {
-        logger::ffail("Invalid settings.");
+        logger::ffail("Invalid settings: ", errbuf);
     }
 
     lsquic_engine_api eapi{};
@@ -83,83 +113,589 @@ void server::init_lsquic(detail::base_quic_stream<quic_stream_value_t> *stream)
     eapi.ea_packets_out     =  ::zpp::quic::detail::packets_out;
     eapi.ea_packets_out_ctx =  this;
     eapi.ea_stream_if       = &SERVER_CALLBACKS;
-    eapi.ea_stream_if_ctx   =  m_stream;
+    eapi.ea_stream_if_ctx   =  this;
     eapi.ea_get_ssl_ctx     =  get_server_ssl_ctx;
+    eapi.ea_lookup_cert     =  lookup_server_cert;
+    eapi.ea_cert_lu_ctx     =  this;
     eapi.ea_settings        = &settings;
+    eapi.ea_pmi             = &SERVER_PACKET_MEMORY;
+    eapi.ea_pmi_ctx         =  this;
+    eapi.ea_generate_scid   =  ::zpp::quic::detail::generate_scid;
+    eapi.ea_gen_scid_ctx    =  this;
 
     m_engine = lsquic_engine_new(LSENG_SERVER,&eapi);
     if (!m_engine) {
         logger::ffail("Creating an engine has failed.");
     }
+
+    m_connections.set_wakeup([this] {
+        schedule_tick();
+    });
+    m_admission.configure(m_handshake_threshold,
+            m_engine_config.handshake_timeout.value_or(std::chrono::seconds(10)), m_validated_ttl);
+    m_connections.set_handshake_observer([this] (detail::connection_context &ctx, bool succeeded) {
+        const sockaddr *local = nullptr;
+        const sockaddr *peer  = nullptr;
+        if (lsquic_conn_get_sockaddr(ctx.connection, &local, &peer) == 0 && peer) {
+            m_admission.handshake_finished(detail::to_socket_address(peer), succeeded);
+        }
+    });
+    m_connections.set_close_observer([this] (detail::connection_context &ctx) {
+        m_transport_stats.closed(ctx.connection, ctx.stats);
+    });
+
+    shard_server = this;
+    register_metrics();
+}
+
+void server::register_metrics() {
+    namespace sm = seastar::metrics;
+
+    m_metrics.add_group("quic_server", {
+        sm::make_histogram("receive_batch_size", sm::description("Datagrams fed to the engine between two ticks"),
+                [this] { return m_batch_sizes.to_metrics(); }),
+        sm::make_counter("forwarded_datagrams_out", m_forwarded_out,
+                sm::description("Datagrams handed over to the shard owning their connection")),
+        sm::make_counter("forwarded_datagrams_in", m_forwarded_in,
+                sm::description("Datagrams received from other shards")),
+        sm::make_counter("forwarded_datagrams_dropped", m_forward_drops,
+                sm::description("Datagrams dropped because too many were on their way to other shards")),
+        sm::make_counter("send_backoffs", m_send_backoffs,
+                sm::description("Times the engine was told to back off because the send queue was full")),
+        sm::make_gauge("send_queue_length", [this] { return m_udp_send_queue.size(); },
+                sm::description("Datagrams waiting to be sent")),
+        sm::make_counter("relayed_datagrams_out", m_relayed_out,
+                sm::description("Datagrams relayed to the process this one has taken over from")),
+        sm::make_counter("relayed_datagrams_in", m_relayed_in,
+                sm::description("Datagrams relayed by the process that has taken over from this one")),
+        sm::make_counter("relayed_datagrams_dropped", m_relay_drops,
+                sm::description("Datagrams dropped because the relay of the previous process was full"))
+    });
+
+    // The pool outlives the server, as it belongs to the shard.
+    m_metrics.add_group("quic_server", {
+        sm::make_counter("packet_buffer_hits", [] { return detail::local_buffer_pool().stats().hits; },
+                sm::description("Packet buffers served from the free list of the shard's pool")),
+        sm::make_counter("packet_buffer_misses", [] { return detail::local_buffer_pool().stats().misses; },
+                sm::description("Packet buffer requests that made the shard's pool grow")),
+        sm::make_gauge("packet_buffers_in_use", [] { return detail::local_buffer_pool().stats().in_use; },
+                sm::description("Packet buffers handed out by the shard's pool")),
+        sm::make_gauge("packet_buffers_high_water_mark", [] { return detail::local_buffer_pool().stats().high_water_mark; },
+                sm::description("The most packet buffers handed out by the shard's pool at once")),
+        sm::make_gauge("packet_buffers_capacity", [] { return detail::local_buffer_pool().stats().capacity; },
+                sm::description("Packet buffers the shard's pool has carved out"))
+    });
+
+    const sm::label result_label("result");
+    const sm::label kind_label("kind");
+    m_metrics.add_group("quic_server", {
+        sm::make_counter("packets_in", m_packets_in,
+                sm::description("Datagrams fed to the engine")),
+        sm::make_counter("bytes_in", m_bytes_in,
+                sm::description("Bytes of the datagrams fed to the engine")),
+        sm::make_counter("packets_out", m_packets_out,
+                sm::description("Datagrams the engine has queued for sending")),
+        sm::make_counter("bytes_out", m_bytes_out,
+                sm::description("Bytes of the datagrams the engine has queued for sending")),
+        sm::make_counter("packet_in_results", m_packets_to_connection,
+                sm::description("Outcomes of lsquic_engine_packet_in"), {result_label("connection")}),
+        sm::make_counter("packet_in_results", m_packets_to_no_connection,
+                sm::description("Outcomes of lsquic_engine_packet_in"), {result_label("no_connection")}),
+        sm::make_counter("packet_in_results", m_packets_failed,
+                sm::description("Outcomes of lsquic_engine_packet_in"), {result_label("error")}),
+        sm::make_counter("engine_ticks", m_engine_ticks,
+                sm::description("Calls to lsquic_engine_process_conns")),
+        sm::make_histogram("tick_duration_us", sm::description("Time spent in a tick of the engine, in microseconds"),
+                [this] { return m_tick_durations.to_metrics(); }),
+        sm::make_gauge("connections", [this] { return m_connections.connection_count(); },
+                sm::description("Open connections")),
+        sm::make_gauge("streams", [this] { return m_connections.stream_count(); },
+                sm::description("Streams not yet closed by the engine")),
+        sm::make_gauge("stream_buffer_bytes", [this] { return m_connections.buffered_bytes(); },
+                sm::description("Bytes buffered by the streams, in both directions"))
+    });
+
+    m_metrics.add_group("quic_server", {
+        sm::make_histogram("connection_rtt_us", sm::description("Smoothed RTT of the connections, sampled periodically and on close"),
+                [this] { return m_transport_stats.rtt().to_metrics(); }),
+        sm::make_histogram("connection_cwnd_bytes", sm::description("Congestion window of the connections, sampled periodically and on close"),
+                [this] { return m_transport_stats.cwnd().to_metrics(); }),
+        sm::make_histogram("connection_lost_packets", sm::description("Packets lost by each closed connection"),
+                [this] { return m_transport_stats.lost_per_connection().to_metrics(); }),
+        sm::make_histogram("connection_retransmitted_packets", sm::description("Packets retransmitted by each closed connection"),
+                [this] { return m_transport_stats.retransmitted_per_connection().to_metrics(); }),
+        sm::make_counter("handshakes", [this] { return m_connections.handshakes().full; },
+                sm::description("Completed handshakes, by kind"), {kind_label("full")}),
+        sm::make_counter("handshakes", [this] { return m_connections.handshakes().resumed; },
+                sm::description("Completed handshakes, by kind"), {kind_label("resumed")}),
+        sm::make_counter("handshakes", [this] { return m_connections.handshakes().failed; },
+                sm::description("Completed handshakes, by kind"), {kind_label("failed")}),
+        sm::make_counter("early_data", [this] { return m_connections.handshakes().early_data_accepted; },
+                sm::description("Handshakes with 0-RTT data, by outcome"), {result_label("accepted")}),
+        sm::make_counter("early_data", [this] { return m_connections.handshakes().early_data_rejected; },
+                sm::description("Handshakes with 0-RTT data, by outcome"), {result_label("rejected")}),
+        sm::make_counter("initials_deferred", [this] { return m_admission.get_stats().deferred; },
+                sm::description("Initial packets dropped from unvalidated addresses while too many handshakes were in flight")),
+        sm::make_counter("initials_validated", [this] { return m_admission.get_stats().validated; },
+                sm::description("Initial packets let in from validated addresses while too many handshakes were in flight")),
+        sm::make_gauge("pending_handshakes", [this] { return m_admission.pending_handshakes(); },
+                sm::description("Handshakes in flight, as tracked by the admission control")),
+        sm::make_counter("connections_closed", [this] { return m_transport_stats.closed_connections(); },
+                sm::description("Connections closed by the engine")),
+        sm::make_counter("packets_lost", [this] { return m_transport_stats.packets_lost(); },
+                sm::description("Packets lost by the closed connections")),
+        sm::make_counter("packets_retransmitted", [this] { return m_transport_stats.packets_retransmitted(); },
+                sm::description("Packets retransmitted by the closed connections"))
+    });
+
+    if (m_socket) {
+        m_metrics.add_group("quic_server", {
+            sm::make_counter("udp_send_calls", [this] { return m_socket->stats().send_calls; },
+                    sm::description("sendmmsg calls made by the socket backend")),
+            sm::make_counter("udp_datagrams_sent", [this] { return m_socket->stats().datagrams_sent; },
+                    sm::description("Datagrams sent by the socket backend")),
+            sm::make_counter("udp_gso_messages", [this] { return m_socket->stats().gso_messages; },
+                    sm::description("Messages sent as a UDP GSO batch")),
+            sm::make_counter("udp_send_errors", [this] { return m_socket->stats().send_errors; },
+                    sm::description("Datagrams dropped because the kernel refused them")),
+            sm::make_counter("udp_receive_calls", [this] { return m_socket->stats().receive_calls; },
+                    sm::description("recvmmsg calls made by the socket backend")),
+            sm::make_counter("udp_datagrams_received", [this] { return m_socket->stats().datagrams_received; },
+                    sm::description("Datagrams received by the socket backend")),
+            sm::make_counter("udp_gro_messages", [this] { return m_socket->stats().gro_messages; },
+                    sm::description("Received messages carrying several datagrams coalesced by UDP GRO"))
+        });
+    }
 }
 
-seastar::future<> server::service_loop(quic_stream<quic_stream_value_t> stream) {
+seastar::future<> server::service_loop() {
     m_timer.set_callback([this] {
-        return timer_expired();
+        timer_expired();
     });
+    if (m_stats_period.count() > 0) {
+        m_stats_sampler.set_callback([this] {
+            sample_connections();
+        });
+        m_stats_sampler.arm_periodic(m_stats_period);
+    }
+
+    return seastar::do_until([this] { return m_input_closed || m_handed_over; }, [this] {
+        return (m_socket ? receive_socket_batch() : receive_batch()).handle_exception([this] (std::exception_ptr ex) {
+            // Closing the input fails the receive the loop is waiting for.
+            return m_input_closed || m_handed_over ? seastar::make_ready_future<>() : seastar::make_exception_future<>(ex);
+        });
+    }).then([this] {
+        return m_stopped.get_future();
+    });
+}
+
+seastar::future<> server::stop(const std::chrono::milliseconds drain_timeout) {
+    if (m_stopping || !m_engine) {
+        return seastar::make_ready_future<>();
+    }
+    m_stopping = true;
+    logger::flog("Stopping the server, draining ", m_connections.stream_count(), " streams of ",
+            m_connections.connection_count(), " connections.");
 
-    return seastar::keep_doing([this, stream]() mutable {
-        quic_stream_value_t buffer[0x1000];
-        std::memset(buffer, 'A', sizeof(buffer));
-        stream.write(buffer, sizeof(buffer));
-        return m_channel.receive().then([this](seastar::net::udp_datagram datagram) {
-            return handle_receive(std::move(datagram));
+    m_accepted.abort(std::make_exception_ptr(server_stopped_error()));
+    m_connections.for_each_connection([] (detail::connection_context &ctx) {
+        lsquic_conn_going_away(ctx.connection);
+    });
+    schedule_tick();
+
+    const auto drain_deadline = seastar::lowres_clock::now() + drain_timeout;
+    return wait_until([this] {
+        return m_connections.stream_count() == 0;
+    }, drain_deadline).then([this] {
+        if (m_connections.stream_count() > 0) {
+            logger::flog("Closing ", m_connections.stream_count(), " streams left after the drain timeout.");
+        }
+
+        // Closing a connection may drop it from the registry, so they are collected first.
+        std::vector<lsquic_conn_t*> connections{};
+        m_connections.for_each_connection([&connections] (detail::connection_context &ctx) {
+            connections.push_back(ctx.connection);
         });
+        for (lsquic_conn_t *connection : connections) {
+            lsquic_conn_close(connection);
+        }
+        process_connections();
+
+        return wait_until([this] {
+            return m_connections.connection_count() == 0 && m_udp_send_queue.empty()
+                    && !lsquic_engine_has_unsent_packets(m_engine);
+        }, seastar::lowres_clock::now() + CLOSE_TIMEOUT);
+    }).then([this] {
+        close_input();
+        return seastar::when_all_succeed(std::exchange(m_udp_sender, seastar::make_ready_future<>()),
+                std::exchange(m_relay_receiver, seastar::make_ready_future<>())).discard_result();
+    }).then([this] {
+        m_timer.cancel();
+        m_stats_sampler.cancel();
+        // Whatever is left is closed by the engine, with the registry still around.
+        lsquic_engine_destroy(m_engine);
+        m_engine = nullptr;
+        m_udp_send_queue.clear();
+        logger::flog("The server has stopped.");
+        m_stopped.set_value();
+    });
+}
+
+template<typename Done>
+seastar::future<> server::wait_until(Done &&done, const seastar::lowres_clock::time_point deadline) {
+    return seastar::do_until([done = std::forward<Done>(done), deadline] {
+        return done() || seastar::lowres_clock::now() >= deadline;
+    }, [] {
+        return seastar::sleep(DRAIN_POLL_PERIOD);
+    });
+}
+
+void server::close_input() {
+    m_input_closed = true;
+    if (m_relay_in) {
+        m_relay_in->shutdown_input();
+    }
+    // A socket handed over to a successor is not read any more.
+    if (m_socket && !m_handed_over) {
+        m_socket->shutdown_input();
+    } else if (!m_socket) {
+        m_channel.shutdown_input();
+    }
+    if (m_pending_receive) {
+        (void) std::move(*std::exchange(m_pending_receive, std::nullopt)).discard_result().handle_exception(
+                [] (std::exception_ptr) {});
+    }
+}
+
+seastar::future<> server::receive_batch() {
+    auto first = m_pending_receive
+            ? std::move(*std::exchange(m_pending_receive, std::nullopt))
+            : m_channel.receive();
+
+    return first.then([this](seastar::net::udp_datagram datagram) {
+        handle_receive(std::move(datagram));
+
+        // Drain whatever the channel has already queued, without waiting.
+        // A receive that is not ready yet is kept for the next batch.
+        const auto deadline = std::chrono::steady_clock::now() + m_batching.time_budget;
+        std::size_t batch_size = 1;
+
+        while (batch_size < m_batching.max_datagrams && std::chrono::steady_clock::now() < deadline) {
+            auto next = m_channel.receive();
+            if (!next.available()) {
+                m_pending_receive.emplace(std::move(next));
+                break;
+            }
+            if (next.failed()) {
+                m_batch_sizes.add(batch_size);
+                process_connections();
+                return next.discard_result();
+            }
+            handle_receive(next.get0());
+            ++batch_size;
+        }
+
+        m_batch_sizes.add(batch_size);
+        process_connections();
+        return seastar::make_ready_future<>();
+    });
+}
+
+seastar::future<> server::receive_socket_batch() {
+    return m_socket->readable().then([this] {
+        detail::udp_socket::receive_handler handler = [this] (const unsigned char *data, std::size_t size,
+                const seastar::socket_address &src, int ecn) {
+            handle_datagram(data, size, src, ecn);
+        };
+
+        const std::size_t batch_size = m_socket->receive(m_batching.max_datagrams, handler);
+        if (batch_size > 0) {
+            m_batch_sizes.add(batch_size);
+            process_connections();
+        }
+    });
+}
+
+void server::accept_relayed(const std::string &path) {
+    m_relay_in.emplace(detail::relay_address(path, detail::cid_generation(), seastar::this_shard_id()));
+    m_relay_receiver = receive_relayed();
+}
+
+seastar::future<> server::receive_relayed() {
+    return seastar::do_until([this] { return m_input_closed; }, [this] {
+        return m_relay_in->readable().then([this] {
+            detail::udp_socket::receive_handler handler = [this] (const unsigned char *data, std::size_t size,
+                    const seastar::socket_address &src, int ecn) {
+                ++m_relayed_in;
+                handle_datagram(data, size, src, ecn);
+            };
+
+            if (m_relay_in->receive(m_batching.max_datagrams, handler) > 0) {
+                process_connections();
+            }
+        }).handle_exception([this] (std::exception_ptr ex) {
+            return m_input_closed ? seastar::make_ready_future<>() : seastar::make_exception_future<>(ex);
+        });
+    }).handle_exception([] (std::exception_ptr ex) {
+        logger::eflog("Receiving relayed datagrams has failed: ", ex);
+    });
+}
+
+void server::relay_to_predecessor(const std::string &path, const std::uint8_t generation) {
+    m_predecessor.clear();
+    for (unsigned shard = 0; shard < seastar::smp::count; ++shard) {
+        m_predecessor.emplace_back(detail::relay_address(path, generation, shard), false);
+    }
+    m_predecessor_shards_left = m_predecessor.size();
+    m_relay_out.emplace();
+}
+
+void server::hand_over_input() {
+    if (!m_socket || m_handed_over) {
+        return;
+    }
+    m_handed_over = true;
+    m_socket->shutdown_input();
+    if (m_pending_receive) {
+        (void) std::move(*std::exchange(m_pending_receive, std::nullopt)).discard_result().handle_exception(
+                [] (std::exception_ptr) {});
+    }
+}
+
+void server::relay_datagram(const unsigned shard, const unsigned char *data, const std::size_t size,
+        const seastar::socket_address &src, const int ecn) {
+    auto &[address, gone] = m_predecessor[shard];
+    switch (m_relay_out->send(address, data, size, src, ecn)) {
+    case detail::relay_result::sent:
+        ++m_relayed_out;
+        break;
+    case detail::relay_result::dropped:
+        ++m_relay_drops;
+        break;
+    case detail::relay_result::gone:
+        // The shards of the predecessor finish draining one by one, and the
+        // others may still have connections. Late datagrams of this one's
+        // get stateless resets from the engine.
+        gone = true;
+        if (--m_predecessor_shards_left == 0) {
+            logger::flog("The previous process has stopped; its datagrams are no longer relayed.");
+            m_relay_out.reset();
+            m_predecessor.clear();
+        }
+        handle_datagram(data, size, src, ecn);
+        break;
+    }
+}
+
+void server::sample_connections() {
+    m_connections.for_each_connection([this] (detail::connection_context &ctx) {
+        m_transport_stats.sample(ctx.connection, ctx.stats);
     });
+    m_transport_stats.flush();
+}
+
+void server::schedule_tick() {
+    if (m_tick_pending) {
+        return;
+    }
+    m_tick_pending = true;
+    rearm_timer(tick_clock::now());
 }
 
-seastar::future<> server::timer_expired() {
-    return process_connections();
+void server::timer_expired() {
+    process_connections();
 }
 
-seastar::future<> server::process_connections() {
-    logger::flog("Ticking the engine.");
+void server::process_connections() {
+    if (!m_engine) {
+        return;
+    }
+    // Anything asking for a tick from now on needs one after this pass.
+    m_tick_pending = false;
 
+    const auto tick_start = std::chrono::steady_clock::now();
+    // While blocked, the send loop asks for a tick once the queue has drained.
+    if (!m_sends_blocked && lsquic_engine_has_unsent_packets(m_engine)) {
+        lsquic_engine_send_unsent_packets(m_engine);
+    }
     lsquic_engine_process_conns(m_engine);
-        
+    ++m_engine_ticks;
+    m_tick_durations.add(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - tick_start).count());
+
+    if (m_tick_pending) {
+        // The timer has been armed for now, which is as early as it gets.
+        return;
+    }
+
     int diff;
-    if (lsquic_engine_earliest_adv_tick(m_engine, &diff)) {
-        logger::flog("Diff: ", diff);
-        const std::int64_t timeout = diff <= 0
-                ? 0
-                : (std::max(diff, LSQUIC_DF_CLOCK_GRANULARITY) / 1000);
-        
-        logger::flog("Tickable connections in: ", timeout);
-        m_timer.rearm(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout));
+    if (!lsquic_engine_earliest_adv_tick(m_engine, &diff)) {
+        // Nothing to do until a datagram or the application wakes us up.
+        m_timer.cancel();
+        return;
+    }
+
+    // lsquic ticks every connection due within the clock granularity, so
+    // waking up earlier than that only buys an empty pass.
+    const std::int64_t timeout_us = diff <= 0
+            ? 0
+            : std::max(diff, LSQUIC_DF_CLOCK_GRANULARITY);
+    rearm_timer(tick_clock::now() + std::chrono::microseconds(timeout_us));
+}
+
+void server::rearm_timer(const tick_clock::time_point deadline) {
+    if (m_timer.armed()) {
+        const auto armed_at = m_timer.get_timeout();
+        if (armed_at <= deadline + TIMER_SLACK && deadline <= armed_at + TIMER_SLACK) {
+            return;
+        }
+    }
+    m_timer.rearm(deadline);
+}
+
+void server::handle_receive(seastar::net::udp_datagram &&datagram) {
+    seastar::net::packet &packet = datagram.get_data();
+
+    // lsquic copies what it needs before `lsquic_engine_packet_in` returns, so
+    // a contiguous datagram can be handed over as it is. Only a fragmented
+    // one has to be linearised first.
+    const unsigned char *data = nullptr;
+    std::optional<detail::buffer_pool::buffer> buffer{};
+
+    if (packet.nr_frags() == 1) {
+        data = reinterpret_cast<const unsigned char*>(packet.fragment_array()->base);
     } else {
-        logger::flog("There are NO tickable connections.");
+        buffer = detail::local_buffer_pool().get(packet.len());
+        if (!buffer) {
+            logger::eflog("Dropping a datagram larger than ", DATAGRAM_SIZE, " bytes.");
+            return;
+        }
+
+        char *dst = buffer->get_write();
+        for (const auto &fragment : packet.fragments()) {
+            std::memcpy(dst, fragment.base, fragment.size);
+            dst += fragment.size;
+        }
+        data = reinterpret_cast<const unsigned char*>(buffer->get());
+    }
+
+    // The channel doesn't tell the ECN bits apart.
+    handle_datagram(data, packet.len(), datagram.get_src(), 0);
+}
+
+void server::handle_datagram(const unsigned char *data, const std::size_t size, const seastar::socket_address &src,
+        const int ecn) {
+    const unsigned owner = detail::route_datagram(data, size);
+    if (m_relay_out && !m_predecessor[owner].second && detail::issued_by_other_generation(data, size)) {
+        relay_datagram(owner, data, size, src, ecn);
+        return;
+    }
+    if (owner != seastar::this_shard_id()) {
+        forward_datagram(owner, data, size, src, ecn);
+        return;
     }
 
-    return seastar::make_ready_future<>();
+    feed_packet(data, size, src, ecn);
 }
 
-seastar::future<> server::handle_receive(seastar::net::udp_datagram &&datagram) {
-    char buffer[DATAGRAM_SIZE];
-    std::memcpy(buffer, datagram.get_data().fragment_array()->base, datagram.get_data().len());
-    buffer[datagram.get_data().len()] = '\0';
+void server::forward_datagram(const unsigned shard, const unsigned char *data, const std::size_t size,
+        const seastar::socket_address &src, const int ecn) {
+    if (m_forwards_in_flight >= MAX_FORWARDS_IN_FLIGHT) {
+        ++m_forward_drops;
+        return;
+    }
+
+    // The datagram's memory belongs to this shard and is gone once we return.
+    seastar::temporary_buffer<char> copy(reinterpret_cast<const char*>(data), size);
+
+    ++m_forwards_in_flight;
+    ++m_forwarded_out;
+    (void) seastar::smp::submit_to(shard, [copy = std::move(copy), src, ecn] () mutable {
+        if (!shard_server) {
+            return seastar::make_ready_future<>();
+        }
+        ++shard_server->m_forwarded_in;
+        shard_server->feed_packet(reinterpret_cast<const unsigned char*>(copy.get()), copy.size(), src, ecn);
+        // A burst of forwarded datagrams is fed before the engine ticks once.
+        shard_server->schedule_tick();
+        return seastar::make_ready_future<>();
+    }).handle_exception([] (std::exception_ptr ex) {
+        logger::eflog("Forwarding a datagram has failed: ", ex);
+    }).finally([this] {
+        --m_forwards_in_flight;
+    });
+}
+
+void server::queue_datagram(const seastar::socket_address &destination, seastar::net::packet &&packet) {
+    m_udp_send_queue.push_back(detail::outgoing_datagram{destination, std::move(packet)});
+    if (!m_sending) {
+        m_sending = true;
+        m_udp_sender = flush_send_queue();
+    }
+}
+
+seastar::future<> server::flush_send_queue() {
+    auto sent = m_socket ? m_socket->send(m_udp_send_queue) : flush_to_channel();
+    return sent.then([this] {
+        if (std::exchange(m_sends_blocked, false)) {
+            // The tick hands lsquic's held back packets to `packets_out` through
+            // `lsquic_engine_send_unsent_packets`, once this loop has finished.
+            schedule_tick();
+        }
+        // Datagrams queued after the send loop has found the queue empty, but
+        // before this continuation has run, have not started a loop of their own.
+        if (!m_udp_send_queue.empty()) {
+            return flush_send_queue();
+        }
+        m_sending = false;
+        return seastar::make_ready_future<>();
+    });
+}
+
+seastar::future<> server::flush_to_channel() {
+    // The channel keeps a single send context, so datagrams go out one at a time.
+    return seastar::do_until([this] { return m_udp_send_queue.empty(); }, [this] {
+        return m_channel.send(m_udp_send_queue.front().destination, std::move(m_udp_send_queue.front().packet))
+                .handle_exception([] (std::exception_ptr ex) {
+            logger::eflog("Sending a datagram has failed: ", ex);
+        }).finally([this] {
+            m_udp_send_queue.pop_front();
+        });
+    });
+}
+
+void server::feed_packet(const unsigned char *data, const std::size_t size, const seastar::socket_address &src,
+        const int ecn) {
+    if (!m_engine || !m_admission.admit(data, size, src)) {
+        return;
+    }
 
     const auto result = lsquic_engine_packet_in(
         m_engine,
-        reinterpret_cast<unsigned char*>(buffer),
-        datagram.get_data().len(),
-        &m_channel.local_address().as_posix_sockaddr(),
-        &datagram.get_src().as_posix_sockaddr(),
+        data,
+        size,
+        &local_address().as_posix_sockaddr(),
+        &src.as_posix_sockaddr(),
         this,
-        0
+        ecn
     );
 
+    ++m_packets_in;
+    m_bytes_in += size;
+
     switch (result) {
     case 0:
-        logger::flog("Packet processed by a connection.");
+        ++m_packets_to_connection;
+        logger::tflog("Packet processed by a connection.");
         break;
     case 1:
-        logger::flog("Packet processed, but not by a connection.");
+        ++m_packets_to_no_connection;
+        logger::tflog("Packet processed, but not by a connection.");
         break;
     default:
+        ++m_packets_failed;
         logger::eflog("Packet processing has failed.");
     }
-
-    return process_connections();
 }
 
 } // namespace quic
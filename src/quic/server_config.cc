@@ -0,0 +1,214 @@
+#include <quic/server_config.hh>
+
+#include <charconv>     // std::from_chars
+#include <fstream>
+#include <limits>
+#include <string>
+
+namespace zpp {
+namespace quic {
+
+namespace {
+
+constexpr std::uint32_t KiB = 1024;
+constexpr std::uint32_t MiB = 1024 * KiB;
+
+std::string_view trim(std::string_view text) noexcept {
+    constexpr std::string_view WHITESPACE = " \t\r\n";
+    const auto first = text.find_first_not_of(WHITESPACE);
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    return text.substr(first, text.find_last_not_of(WHITESPACE) - first + 1);
+}
+
+std::uint32_t parse_u32(std::string_view key, std::string_view value) {
+    std::uint64_t result = 0;
+    const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc{} || end != value.data() + value.size()
+            || result > std::numeric_limits<std::uint32_t>::max()) {
+        throw config_error("'" + std::string(key) + "' expects an unsigned 32-bit number, got '" + std::string(value) + "'");
+    }
+    return static_cast<std::uint32_t>(result);
+}
+
+bool parse_bool(std::string_view key, std::string_view value) {
+    if (value == "true" || value == "on" || value == "1") {
+        return true;
+    }
+    if (value == "false" || value == "off" || value == "0") {
+        return false;
+    }
+    throw config_error("'" + std::string(key) + "' expects true or false, got '" + std::string(value) + "'");
+}
+
+congestion_control parse_congestion(std::string_view key, std::string_view value) {
+    if (value == "cubic") {
+        return congestion_control::cubic;
+    }
+    if (value == "bbr") {
+        return congestion_control::bbr;
+    }
+    if (value == "adaptive") {
+        return congestion_control::adaptive;
+    }
+    throw config_error("'" + std::string(key) + "' expects cubic, bbr or adaptive, got '" + std::string(value) + "'");
+}
+
+} // anonymous namespace
+
+server_config server_config::profile(std::string_view name) {
+    server_config result{};
+
+    if (name == "default") {
+        return result;
+    }
+
+    if (name == "bulk-throughput") {
+        // Few long transfers: windows wide enough for a high bandwidth-delay
+        // product, and BBR, which doesn't collapse on random loss.
+        result.connection_window        = 16 * MiB;
+        result.stream_window            = 8 * MiB;
+        result.max_connection_window    = 64 * MiB;
+        result.max_stream_window        = 32 * MiB;
+        result.max_streams              = 100;
+        result.congestion               = congestion_control::bbr;
+        result.pacing                   = true;
+        result.idle_timeout             = std::chrono::seconds(60);
+        return result;
+    }
+
+    if (name == "low-latency") {
+        // Many short requests: plenty of streams, modest windows that keep
+        // queues short, and quick give-ups on dead peers and handshakes.
+        result.connection_window        = 1 * MiB;
+        result.stream_window            = 256 * KiB;
+        result.max_connection_window    = 4 * MiB;
+        result.max_stream_window        = 1 * MiB;
+        result.max_streams              = 1000;
+        result.congestion               = congestion_control::adaptive;
+        result.pacing                   = true;
+        result.idle_timeout             = std::chrono::seconds(10);
+        result.handshake_timeout        = std::chrono::seconds(3);
+        return result;
+    }
+
+    throw config_error("Unknown profile '" + std::string(name) + "', expected one of: " + std::string(PROFILES));
+}
+
+void server_config::apply(std::string_view key, std::string_view value) {
+    key   = trim(key);
+    value = trim(value);
+
+    if (key == "connection-window") {
+        connection_window = parse_u32(key, value);
+    } else if (key == "stream-window") {
+        stream_window = parse_u32(key, value);
+    } else if (key == "max-connection-window") {
+        max_connection_window = parse_u32(key, value);
+    } else if (key == "max-stream-window") {
+        max_stream_window = parse_u32(key, value);
+    } else if (key == "max-streams") {
+        max_streams = parse_u32(key, value);
+    } else if (key == "congestion-control") {
+        congestion = parse_congestion(key, value);
+    } else if (key == "pacing") {
+        pacing = parse_bool(key, value);
+    } else if (key == "ecn") {
+        ecn = parse_bool(key, value);
+    } else if (key == "idle-timeout-s") {
+        idle_timeout = std::chrono::seconds(parse_u32(key, value));
+    } else if (key == "handshake-timeout-ms") {
+        handshake_timeout = std::chrono::milliseconds(parse_u32(key, value));
+    } else if (key == "max-handshaking") {
+        max_handshaking = parse_u32(key, value);
+    } else {
+        throw config_error("Unknown engine option '" + std::string(key) + "'");
+    }
+}
+
+void server_config::apply(std::string_view option) {
+    const auto separator = option.find('=');
+    if (separator == std::string_view::npos) {
+        throw config_error("Expected key=value, got '" + std::string(option) + "'");
+    }
+    apply(option.substr(0, separator), option.substr(separator + 1));
+}
+
+void server_config::apply_file(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw config_error("Cannot open the configuration file " + path);
+    }
+
+    std::string line;
+    for (std::size_t number = 1; std::getline(file, line); ++number) {
+        const std::string_view text = trim(line);
+        if (text.empty() || text.front() == '#') {
+            continue;
+        }
+
+        try {
+            apply(text);
+        } catch (const config_error &e) {
+            throw config_error(path + ':' + std::to_string(number) + ": " + e.what());
+        }
+    }
+}
+
+void server_config::fill(lsquic_engine_settings &settings) const noexcept {
+    // lsquic keeps the windows and stream limits of gQUIC and IETF QUIC
+    // apart; both are set, whichever version the peer speaks.
+    if (connection_window) {
+        settings.es_cfcw            = *connection_window;
+        settings.es_init_max_data   = *connection_window;
+    }
+    if (stream_window) {
+        settings.es_sfcw                                = *stream_window;
+        settings.es_init_max_stream_data_bidi_remote    = *stream_window;
+        settings.es_init_max_stream_data_bidi_local     = *stream_window;
+    }
+    if (max_connection_window) {
+        settings.es_max_cfcw = *max_connection_window;
+    }
+    if (max_stream_window) {
+        settings.es_max_sfcw = *max_stream_window;
+    }
+    if (max_streams) {
+        settings.es_max_streams_in          = *max_streams;
+        settings.es_init_max_streams_bidi   = *max_streams;
+    }
+    if (congestion) {
+        settings.es_cc_algo = static_cast<unsigned>(*congestion);
+    }
+    if (pacing) {
+        settings.es_pace_packets = *pacing;
+    }
+    if (ecn) {
+        settings.es_ecn = *ecn;
+    }
+    if (idle_timeout) {
+        settings.es_idle_timeout = static_cast<unsigned>(idle_timeout->count());
+    }
+    if (handshake_timeout) {
+        settings.es_handshake_to = static_cast<unsigned>(handshake_timeout->count());
+    }
+    if (max_handshaking) {
+        settings.es_max_inchoate = *max_handshaking;
+    }
+}
+
+std::optional<std::string> server_config::check() const {
+    lsquic_engine_settings settings{};
+    lsquic_engine_init_settings(&settings, LSENG_SERVER);
+    fill(settings);
+
+    char errbuf[0x100];
+    if (lsquic_engine_check_settings(&settings, LSENG_SERVER, errbuf, sizeof(errbuf)) != 0) {
+        return std::string(errbuf);
+    }
+    return std::nullopt;
+}
+
+} // namespace quic
+} // namespace zpp
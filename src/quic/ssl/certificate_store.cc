@@ -0,0 +1,166 @@
+#include <quic/ssl/certificate_store.hh>
+#include <quic/ssl/ssl_handler.hh>
+
+#include <utils/logger.hh>
+
+#include <seastar/core/smp.hh>
+
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>  // std::sort, std::transform
+#include <cctype>     // std::tolower
+#include <filesystem>
+#include <string_view>
+
+namespace zpp {
+namespace quic {
+namespace ssl {
+
+namespace {
+
+constexpr std::string_view CERT_SUFFIX  = "-cert.pem";
+constexpr std::string_view KEY_SUFFIX   = "-key.pem";
+
+/** The store of the calling shard. Every shard points at the same one. */
+thread_local std::shared_ptr<const certificate_store> local_store{};
+
+std::string to_lower(std::string_view name) {
+    std::string result(name);
+    std::transform(result.begin(), result.end(), result.begin(), [] (unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return result;
+}
+
+/** The DNS names of the subjectAltName extension, or the common name without them. */
+std::vector<std::string> served_names(SSL_CTX *ctx) {
+    std::vector<std::string> result{};
+    X509 *cert = SSL_CTX_get0_certificate(ctx);
+    if (!cert) {
+        return result;
+    }
+
+    auto *alt_names = static_cast<GENERAL_NAMES*>(X509_get_ext_d2i(cert, NID_subject_alt_name, nullptr, nullptr));
+    if (alt_names) {
+        for (std::size_t i = 0; i < sk_GENERAL_NAME_num(alt_names); ++i) {
+            const GENERAL_NAME *name = sk_GENERAL_NAME_value(alt_names, i);
+            if (name->type != GEN_DNS) {
+                continue;
+            }
+            const auto *data = reinterpret_cast<const char*>(ASN1_STRING_get0_data(name->d.dNSName));
+            result.push_back(to_lower(std::string_view(data, ASN1_STRING_length(name->d.dNSName))));
+        }
+        GENERAL_NAMES_free(alt_names);
+    }
+
+    if (result.empty()) {
+        const X509_NAME *subject = X509_get_subject_name(cert);
+        const int idx = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
+        if (idx >= 0) {
+            const ASN1_STRING *cn = X509_NAME_ENTRY_get_data(X509_NAME_get_entry(subject, idx));
+            const auto *data = reinterpret_cast<const char*>(ASN1_STRING_get0_data(cn));
+            result.push_back(to_lower(std::string_view(data, ASN1_STRING_length(cn))));
+        }
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+certificate_store::~certificate_store() {
+    // Connections hold references of their own, so they outlive the store.
+    for (SSL_CTX *ctx : m_contexts) {
+        SSL_CTX_free(ctx);
+    }
+}
+
+std::shared_ptr<const certificate_store> certificate_store::load(const std::string &directory,
+        const std::string &default_name) {
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> pairs{};
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(directory, ec)) {
+        const std::string file = entry.path().filename().string();
+        if (file.size() > CERT_SUFFIX.size() && file.ends_with(CERT_SUFFIX)) {
+            pairs.push_back(file.substr(0, file.size() - CERT_SUFFIX.size()));
+        }
+    }
+    if (ec) {
+        throw certificate_error("Cannot read the certificate directory " + directory + ": " + ec.message());
+    }
+    if (pairs.empty()) {
+        throw certificate_error("No *" + std::string(CERT_SUFFIX) + " files in " + directory);
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    auto store = std::make_shared<certificate_store>();
+    for (const auto &name : pairs) {
+        const std::string cert_file = (fs::path(directory) / (name + std::string(CERT_SUFFIX))).string();
+        const std::string key_file  = (fs::path(directory) / (name + std::string(KEY_SUFFIX))).string();
+
+        SSL_CTX *ctx = nullptr;
+        if (load_cert(cert_file.c_str(), key_file.c_str(), &ctx) != 0 || !ctx) {
+            throw certificate_error("Cannot load the certificate " + cert_file + " with the key " + key_file);
+        }
+        store->m_contexts.push_back(ctx);
+
+        if (name == default_name || (default_name.empty() && !store->m_default)) {
+            store->m_default = ctx;
+        }
+        for (auto &served : served_names(ctx)) {
+            // The first pair by name wins a name served by several.
+            store->m_by_name.emplace(std::move(served), ctx);
+        }
+    }
+
+    if (!store->m_default) {
+        throw certificate_error("No " + default_name + std::string(CERT_SUFFIX) + " in " + directory);
+    }
+    return store;
+}
+
+SSL_CTX *certificate_store::find(const char *sni) const noexcept {
+    if (!sni) {
+        return m_default;
+    }
+
+    try {
+        const std::string name = to_lower(sni);
+        if (const auto it = m_by_name.find(name); it != m_by_name.end()) {
+            return it->second;
+        }
+        if (const auto dot = name.find('.'); dot != std::string::npos) {
+            if (const auto it = m_by_name.find('*' + name.substr(dot)); it != m_by_name.end()) {
+                return it->second;
+            }
+        }
+    } catch (...) {
+        // Running out of memory for a name only costs the client its certificate.
+    }
+    return m_default;
+}
+
+const certificate_store *local_certificates() noexcept {
+    return local_store.get();
+}
+
+seastar::future<> install_certificates(const std::string &directory, const std::string &default_name) {
+    std::shared_ptr<const certificate_store> store{};
+    try {
+        store = certificate_store::load(directory, default_name);
+    } catch (...) {
+        return seastar::current_exception_as_future();
+    }
+
+    logger::flog("Loaded ", store->size(), " certificates from ", directory, '.');
+    // std::shared_ptr counts atomically, so the copies can be dropped on any shard.
+    return seastar::smp::invoke_on_all([store] {
+        local_store = store;
+    });
+}
+
+} // namespace ssl
+} // namespace quic
+} // namespace zpp
@@ -1,12 +1,22 @@
 #include <quic/ssl/ssl_handler.hh>
 
+#include <openssl/aead.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/x509.h>
 #include <openssl/ssl.h>
 
 #include <utils/logger.hh>
 
+#include <array>
 #include <cstdint>
+#include <cstring>      // std::memcmp, std::memcpy
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>      // std::exchange
 
 namespace zpp {
 namespace quic {
@@ -45,8 +55,259 @@ int select_alpn(
     }
 }
 
+using ticket_clock = std::chrono::steady_clock;
+
+/** A ticket is the key name, a nonce, and the session sealed with AES-128-GCM under that key. */
+constexpr std::size_t TICKET_NAME_SIZE  = 16;
+constexpr std::size_t TICKET_NONCE_SIZE = 12;
+constexpr std::size_t TICKET_TAG_SIZE   = 16;
+constexpr std::size_t TICKET_OVERHEAD   = TICKET_NAME_SIZE + TICKET_NONCE_SIZE + TICKET_TAG_SIZE;
+
+struct ticket_key {
+    std::array<std::uint8_t, TICKET_NAME_SIZE>  name{};
+    std::array<std::uint8_t, 16>                aes_key{};
+    ticket_clock::time_point                    created{};
+
+    static ticket_key generate() {
+        ticket_key result{};
+        RAND_bytes(result.name.data(), result.name.size());
+        RAND_bytes(result.aes_key.data(), result.aes_key.size());
+        result.created = ticket_clock::now();
+        return result;
+    }
+};
+
+/**
+ * Ticket keys shared by every shard. They are only needed when a ticket is
+ * issued or presented, never per packet, so a mutex is cheap enough.
+ */
+class ticket_key_store {
+private:
+    /** Tickets remembered by the single-use policy; beyond that, the oldest ones are forgotten. */
+    static constexpr std::size_t MAX_USED_TICKETS = 1 << 18;
+
+    std::mutex                                          m_mutex{};
+    session_options                                     m_options{};
+    std::optional<ticket_key>                           m_current{};
+    std::optional<ticket_key>                           m_previous{};
+    /** Tickets already resumed from, by key name and IV, and when they expire. */
+    std::unordered_map<std::string, ticket_clock::time_point> m_used{};
+    std::deque<std::pair<ticket_clock::time_point, std::string>> m_used_order{};
+
+public:
+    void configure(const session_options &options) {
+        std::lock_guard lock(m_mutex);
+        m_options = options;
+    }
+
+    session_options options() {
+        std::lock_guard lock(m_mutex);
+        return m_options;
+    }
+
+    /** @brief The key to encrypt new tickets with. */
+    ticket_key current() {
+        std::lock_guard lock(m_mutex);
+        rotate();
+        return *m_current;
+    }
+
+    /** @return The key called `name`, if it's still in use. */
+    std::optional<ticket_key> find(const std::uint8_t *name) {
+        std::lock_guard lock(m_mutex);
+        rotate();
+        if (std::memcmp(name, m_current->name.data(), m_current->name.size()) == 0) {
+            return *m_current;
+        }
+        if (m_previous && std::memcmp(name, m_previous->name.data(), m_previous->name.size()) == 0) {
+            return *m_previous;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Marks a ticket as used. Call it only for authenticated tickets,
+     *        or anyone could fill the register with made-up ones.
+     * @return Whether the ticket may resume a session under the early data policy.
+     */
+    bool admit(const std::uint8_t *name, const std::uint8_t *nonce) {
+        std::lock_guard lock(m_mutex);
+        if (m_options.early_data != early_data_policy::single_use) {
+            return true;
+        }
+
+        const auto now = ticket_clock::now();
+        while (!m_used_order.empty() && m_used_order.front().first <= now) {
+            m_used.erase(m_used_order.front().second);
+            m_used_order.pop_front();
+        }
+        std::string id(reinterpret_cast<const char*>(name), TICKET_NAME_SIZE);
+        id.append(reinterpret_cast<const char*>(nonce), TICKET_NONCE_SIZE);
+        if (m_used.contains(id)) {
+            return false;
+        }
+
+        if (m_used_order.size() >= MAX_USED_TICKETS) {
+            // Only a replay of a ticket this old slips through, rather than
+            // every client losing resumption.
+            m_used.erase(m_used_order.front().second);
+            m_used_order.pop_front();
+        }
+        // A ticket can't be decrypted after two rotations, so it can be forgotten by then.
+        const auto expiry = now + 2 * m_options.key_rotation;
+        m_used.emplace(id, expiry);
+        m_used_order.emplace_back(expiry, std::move(id));
+        return true;
+    }
+
+private:
+    void rotate() {
+        const auto now = ticket_clock::now();
+        if (!m_current) {
+            m_current = ticket_key::generate();
+        } else if (now - m_current->created >= m_options.key_rotation) {
+            m_previous = std::exchange(m_current, ticket_key::generate());
+        }
+    }
+};
+
+ticket_key_store ticket_keys{};
+
+std::size_t ticket_max_overhead([[maybe_unused]] SSL *ssl) {
+    return TICKET_OVERHEAD;
+}
+
+int seal_ticket(
+    [[maybe_unused]] SSL *ssl,
+    std::uint8_t *out,
+    std::size_t *out_len,
+    std::size_t max_out_len,
+    const std::uint8_t *in,
+    std::size_t in_len)
+{
+    if (max_out_len < TICKET_NAME_SIZE + TICKET_NONCE_SIZE) {
+        return 0;
+    }
+
+    const ticket_key key = ticket_keys.current();
+    std::uint8_t *name  = out;
+    std::uint8_t *nonce = out + TICKET_NAME_SIZE;
+    std::memcpy(name, key.name.data(), key.name.size());
+    RAND_bytes(nonce, TICKET_NONCE_SIZE);
+
+    EVP_AEAD_CTX ctx;
+    if (!EVP_AEAD_CTX_init(&ctx, EVP_aead_aes_128_gcm(), key.aes_key.data(), key.aes_key.size(),
+            TICKET_TAG_SIZE, nullptr)) {
+        return 0;
+    }
+    std::size_t sealed = 0;
+    const int ok = EVP_AEAD_CTX_seal(&ctx, nonce + TICKET_NONCE_SIZE, &sealed,
+            max_out_len - TICKET_NAME_SIZE - TICKET_NONCE_SIZE, nonce, TICKET_NONCE_SIZE,
+            in, in_len, name, TICKET_NAME_SIZE);
+    EVP_AEAD_CTX_cleanup(&ctx);
+    if (!ok) {
+        return 0;
+    }
+    *out_len = TICKET_NAME_SIZE + TICKET_NONCE_SIZE + sealed;
+    return 1;
+}
+
+ssl_ticket_aead_result_t open_ticket(
+    [[maybe_unused]] SSL *ssl,
+    std::uint8_t *out,
+    std::size_t *out_len,
+    std::size_t max_out_len,
+    const std::uint8_t *in,
+    std::size_t in_len)
+{
+    // An ignored ticket makes BoringSSL fall back to a full handshake.
+    if (in_len < TICKET_OVERHEAD) {
+        return ssl_ticket_aead_ignore_ticket;
+    }
+    const std::uint8_t *name  = in;
+    const std::uint8_t *nonce = in + TICKET_NAME_SIZE;
+    const auto found = ticket_keys.find(name);
+    if (!found) {
+        return ssl_ticket_aead_ignore_ticket;
+    }
+
+    const ticket_key &key = *found;
+    EVP_AEAD_CTX ctx;
+    if (!EVP_AEAD_CTX_init(&ctx, EVP_aead_aes_128_gcm(), key.aes_key.data(), key.aes_key.size(),
+            TICKET_TAG_SIZE, nullptr)) {
+        return ssl_ticket_aead_error;
+    }
+    const int ok = EVP_AEAD_CTX_open(&ctx, out, out_len, max_out_len, nonce, TICKET_NONCE_SIZE,
+            nonce + TICKET_NONCE_SIZE, in_len - TICKET_NAME_SIZE - TICKET_NONCE_SIZE, name, TICKET_NAME_SIZE);
+    EVP_AEAD_CTX_cleanup(&ctx);
+
+    // Only an authentic ticket counts as used; a forged one never reaches the register.
+    if (!ok || !ticket_keys.admit(name, nonce)) {
+        return ssl_ticket_aead_ignore_ticket;
+    }
+    return ssl_ticket_aead_success;
+}
+
+constinit SSL_TICKET_AEAD_METHOD TICKET_METHOD = {
+    .max_overhead   = ticket_max_overhead,
+    .seal           = seal_ticket,
+    .open           = open_ticket
+};
+
+void configure_ssl_sessions(SSL_CTX *ssl_ctx) {
+    const session_options options = ticket_keys.options();
+
+    if (!options.tickets) {
+        SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
+        return;
+    }
+
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_timeout(ssl_ctx, static_cast<std::uint32_t>(options.ticket_lifetime.count()));
+    SSL_CTX_set_ticket_aead_method(ssl_ctx, &TICKET_METHOD);
+    SSL_CTX_set_early_data_enabled(ssl_ctx, options.early_data != early_data_policy::disabled);
+}
+
 } // anonymous namespace
 
+void handshake_stats::record(lsquic_conn_t *connection, lsquic_hsk_status status) noexcept {
+    switch (status) {
+    case LSQ_HSK_OK:
+        ++full;
+        break;
+    case LSQ_HSK_RESUMED_OK:
+        ++resumed;
+        break;
+    default:
+        ++failed;
+        return;
+    }
+
+    const SSL *ssl = lsquic_conn_ssl(connection);
+    if (!ssl) {
+        return;
+    }
+
+    switch (SSL_get_early_data_reason(ssl)) {
+    case ssl_early_data_accepted:
+        ++early_data_accepted;
+        break;
+    case ssl_early_data_unknown:
+    case ssl_early_data_disabled:
+    case ssl_early_data_protocol_version:
+    case ssl_early_data_peer_declined:
+    case ssl_early_data_no_session_offered:
+        // No 0-RTT data has been offered.
+        break;
+    default:
+        ++early_data_rejected;
+    }
+}
+
+void configure_sessions(const session_options &options) {
+    ticket_keys.configure(options);
+}
+
 int load_cert(const char *cert_file, const char *key_file, SSL_CTX **ssl_ctx) {
     int rv = -1;
     *ssl_ctx = SSL_CTX_new(TLS_method());
@@ -68,6 +329,7 @@ int load_cert(const char *cert_file, const char *key_file, SSL_CTX **ssl_ctx) {
     SSL_CTX_set_max_proto_version(*ssl_ctx, TLS1_3_VERSION);
     SSL_CTX_set_default_verify_paths(*ssl_ctx);
     SSL_CTX_set_alpn_select_cb(*ssl_ctx, select_alpn, nullptr);
+    configure_ssl_sessions(*ssl_ctx);
 
     if (SSL_CTX_use_certificate_chain_file(*ssl_ctx, cert_file) != 1) {
         logger::eflog("SSL_CTX_use_certificate_chain_file has failed");